@@ -0,0 +1,231 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Bitboard helpers, used where a search needs to be faster than
+ *    the 10x10 board of chris.c allows.
+ *
+ *H***********************************************************************/
+
+#include "bitboard.h"
+#include "edge_stability.h"
+
+
+int bit_count(uint64_t b) {
+	return __builtin_popcountll(b);
+}
+
+/**
+ * All squares where P can move, O disks are bracketed in up to 6 steps
+ */
+uint64_t get_moves(uint64_t P, uint64_t O) {
+	uint64_t inner = O & 0x7E7E7E7E7E7E7E7EULL; // no wrapping for horizontal and diagonal steps
+	uint64_t moves = 0, t;
+	int i;
+
+	// left, right
+	t = inner & (P << 1); for (i = 0; i < 5; i++) t |= inner & (t << 1); moves |= t << 1;
+	t = inner & (P >> 1); for (i = 0; i < 5; i++) t |= inner & (t >> 1); moves |= t >> 1;
+	// up, down
+	t = O & (P << 8); for (i = 0; i < 5; i++) t |= O & (t << 8); moves |= t << 8;
+	t = O & (P >> 8); for (i = 0; i < 5; i++) t |= O & (t >> 8); moves |= t >> 8;
+	// diagonals
+	t = inner & (P << 7); for (i = 0; i < 5; i++) t |= inner & (t << 7); moves |= t << 7;
+	t = inner & (P >> 7); for (i = 0; i < 5; i++) t |= inner & (t >> 7); moves |= t >> 7;
+	t = inner & (P << 9); for (i = 0; i < 5; i++) t |= inner & (t << 9); moves |= t << 9;
+	t = inner & (P >> 9); for (i = 0; i < 5; i++) t |= inner & (t >> 9); moves |= t >> 9;
+
+	return moves & ~(P | O);
+}
+
+// Disks of one direction, walking from x while on mO, kept if the walk ends on P
+#define FLIP_DIR(SHIFT, mO) \
+	f = 0; \
+	t = SHIFT(x); \
+	while (t & (mO)) { f |= t; t = SHIFT(t); } \
+	if (t & P) flips |= f;
+
+#define LEFT_1(b) ((b) << 1)
+#define RIGHT_1(b) ((b) >> 1)
+#define LEFT_7(b) ((b) << 7)
+#define RIGHT_7(b) ((b) >> 7)
+#define LEFT_8(b) ((b) << 8)
+#define RIGHT_8(b) ((b) >> 8)
+#define LEFT_9(b) ((b) << 9)
+#define RIGHT_9(b) ((b) >> 9)
+
+/**
+ * Disks that flip when P plays on sq, 0 if the move is not legal
+ */
+uint64_t get_flips(int sq, uint64_t P, uint64_t O) {
+	uint64_t x = BIT(sq), inner = O & 0x7E7E7E7E7E7E7E7EULL;
+	uint64_t flips = 0, f, t;
+
+	FLIP_DIR(LEFT_1, inner);
+	FLIP_DIR(RIGHT_1, inner);
+	FLIP_DIR(LEFT_8, O);
+	FLIP_DIR(RIGHT_8, O);
+	FLIP_DIR(LEFT_7, inner);
+	FLIP_DIR(RIGHT_7, inner);
+	FLIP_DIR(LEFT_9, inner);
+	FLIP_DIR(RIGHT_9, inner);
+	return flips;
+}
+
+/**
+ * Disk difference for P when the game is over, empty squares go to the winner
+ */
+int final_score(uint64_t P, uint64_t O) {
+	int p = bit_count(P), o = bit_count(O);
+	int empties = 64 - p - o;
+
+	if (p > o) return p - o + empties;
+	if (p < o) return p - o - empties;
+	return 0;
+}
+
+/**
+ * Number of disks P flips by playing sq when sq is the last empty square.
+ * Every square that is not P belongs to the other side, nothing is changed.
+ */
+int count_last_flip(int sq, uint64_t P) {
+	uint64_t x = BIT(sq), O = ~P & ~x, inner = O & 0x7E7E7E7E7E7E7E7EULL;
+	uint64_t flips = 0, f, t;
+
+	FLIP_DIR(LEFT_1, inner);
+	FLIP_DIR(RIGHT_1, inner);
+	FLIP_DIR(LEFT_8, O);
+	FLIP_DIR(RIGHT_8, O);
+	FLIP_DIR(LEFT_7, inner);
+	FLIP_DIR(RIGHT_7, inner);
+	FLIP_DIR(LEFT_9, inner);
+	FLIP_DIR(RIGHT_9, inner);
+	return bit_count(flips);
+}
+
+/**
+ * Occupied squares whose ray towards shift is filled up to the edge of the board,
+ * boundary holds the squares where that ray leaves the board.
+ * Each step doubles the length of the ray that is checked.
+ */
+static uint64_t full_ray(uint64_t occupied, uint64_t boundary, int shift) {
+	uint64_t full = occupied;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		if (shift > 0) {
+			full &= boundary | (full >> shift);
+			boundary |= boundary >> shift;
+		} else {
+			full &= boundary | (full << -shift);
+			boundary |= boundary << -shift;
+		}
+		shift *= 2;
+	}
+	return full;
+}
+
+/**
+ * Squares whose line is completely filled, one mask for each of the four directions
+ */
+static void get_full_lines(uint64_t occupied, uint64_t full[4]) {
+	uint64_t t;
+
+	// horizontal: bit 8r ends up as the AND of row r
+	t = occupied & (occupied >> 4);
+	t &= t >> 2;
+	t &= t >> 1;
+	full[0] = (t & 0x0101010101010101ULL) * 0xFF;
+	// vertical
+	t = occupied & (occupied >> 32);
+	t &= t >> 16;
+	t &= t >> 8;
+	full[1] = (t & 0xFF) * 0x0101010101010101ULL;
+	// diagonals, both rays must be full
+	full[2] = full_ray(occupied, 0xFF80808080808080ULL, 9) & full_ray(occupied, 0x01010101010101FFULL, -9);
+	full[3] = full_ray(occupied, 0xFF01010101010101ULL, 7) & full_ray(occupied, 0x80808080808080FFULL, -7);
+}
+
+/**
+ * Edge stability of the 8 disks of a row, from the table made by tools/edge_stability.c
+ */
+static int edge_stable_row(int p, int o) {
+	return edge_stable[edge_ternary[p] + 2 * edge_ternary[o]];
+}
+
+/**
+ * Column 0 of b as the 8 bits of a row, and back
+ */
+static int column_to_row(uint64_t b) {
+	return ((b & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+}
+
+static uint64_t row_to_column(int row) {
+	return (((uint64_t) (row & 0x7F) * 0x0002040810204081ULL) & 0x0101010101010101ULL) | ((uint64_t) (row & 0x80) << 49);
+}
+
+/**
+ * Stable disks of one colour, growing the stable disks given: an inner disk is stable
+ * when in each direction its line is full or it touches a stable disk of its colour.
+ * Repeated until nothing is added.
+ */
+static uint64_t stable_by_contact(uint64_t own, uint64_t stable, const uint64_t full[4]) {
+	uint64_t added, h, v, d, a;
+
+	own &= 0x007E7E7E7E7E7E00ULL; // edge disks are already known from the table
+	do {
+		h = full[0] | ((stable >> 1) & 0x7F7F7F7F7F7F7F7FULL) | ((stable << 1) & 0xFEFEFEFEFEFEFEFEULL);
+		v = full[1] | (stable >> 8) | (stable << 8);
+		d = full[2] | ((stable >> 9) & 0x7F7F7F7F7F7F7F7FULL) | ((stable << 9) & 0xFEFEFEFEFEFEFEFEULL);
+		a = full[3] | ((stable >> 7) & 0xFEFEFEFEFEFEFEFEULL) | ((stable << 7) & 0x7F7F7F7F7F7F7F7FULL);
+		added = own & h & v & d & a & ~stable;
+		stable |= added;
+	} while (added);
+	return stable;
+}
+
+/**
+ * Disks of P next to at least one empty square
+ */
+uint64_t get_frontier(uint64_t P, uint64_t O) {
+	uint64_t empty = ~(P | O), row, around;
+
+	row = empty | ((empty >> 1) & 0x7F7F7F7F7F7F7F7FULL) | ((empty << 1) & 0xFEFEFEFEFEFEFEFEULL);
+	around = row | (row >> 8) | (row << 8);
+	return P & around;
+}
+
+/**
+ * A lower bound on the stable disks of both colours, disks that can never flip.
+ * - Edge disks that no sequence of moves along the edge can flip
+ * - Disks with all four lines through them full
+ * - Disks held in every direction by a full line or a stable disk of their colour
+ */
+uint64_t get_stable(uint64_t P, uint64_t O) {
+	return grow_stable(P, O, edge_stable_after(P, O, 0, ~0ULL));
+}
+
+/**
+ * Stable disks after a move, from the stable disks before it: only the edges
+ * with a changed square are looked up again. Stable disks stay stable.
+ */
+uint64_t edge_stable_after(uint64_t P, uint64_t O, uint64_t stable, uint64_t changed) {
+	if (changed & 0x00000000000000FFULL) stable |= (uint64_t) edge_stable_row(P & 0xFF, O & 0xFF);
+	if (changed & 0xFF00000000000000ULL) stable |= (uint64_t) edge_stable_row(P >> 56, O >> 56) << 56;
+	if (changed & 0x0101010101010101ULL) stable |= row_to_column(edge_stable_row(column_to_row(P), column_to_row(O)));
+	if (changed & 0x8080808080808080ULL) stable |= row_to_column(edge_stable_row(column_to_row(P >> 7), column_to_row(O >> 7))) << 7;
+	return stable;
+}
+
+/**
+ * Adds the inner stable disks to stable disks that already include the edges:
+ * disks on four full lines, then the fixpoint of stable_by_contact
+ */
+uint64_t grow_stable(uint64_t P, uint64_t O, uint64_t stable) {
+	uint64_t full[4];
+
+	get_full_lines(P | O, full);
+	stable |= full[0] & full[1] & full[2] & full[3] & (P | O);
+	if (stable == 0) return 0;
+	return stable_by_contact(P, stable & P, full) | stable_by_contact(O, stable & O, full);
+}
@@ -0,0 +1,23 @@
+#ifndef _BITBOARD_H
+#define _BITBOARD_H
+
+#include <stdint.h>
+
+/*
+ * Bit i of a bitboard is square (row i / 8, column i % 8), row 0 at the top.
+ * P holds the disks of the side to move, O those of the other side.
+ */
+
+#define BIT(sq) (1ULL << (sq))
+
+int bit_count(uint64_t b);
+uint64_t get_moves(uint64_t P, uint64_t O);
+uint64_t get_flips(int sq, uint64_t P, uint64_t O);
+int final_score(uint64_t P, uint64_t O);
+int count_last_flip(int sq, uint64_t P);
+uint64_t get_frontier(uint64_t P, uint64_t O);
+uint64_t get_stable(uint64_t P, uint64_t O);
+uint64_t edge_stable_after(uint64_t P, uint64_t O, uint64_t stable, uint64_t changed);
+uint64_t grow_stable(uint64_t P, uint64_t O, uint64_t stable);
+
+#endif
@@ -17,56 +17,90 @@
 #include <arpa/inet.h>
 #include <mpi.h>
 #include <time.h>
+#include <math.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
 #include "comms.h"
-
-#define STARTING_MAX_DEPTH 7 	// If stability is not used, this depth can be pushed to about 9
-#define MAX_DEPTH 15			// when iterative deepening stops
-#define MAX_TIME 4
+#include "bitboard.h"
+#include "endgame.h"
+#include "pns.h"
+#include "pattern.h"
+#include "nnue.h"
+#include "sample.h"
+
+#define STARTING_MAX_DEPTH 7 	// first depth of iterative deepening, stability no longer slows it down
+#define DEPTH_LIMIT 15			// when iterative deepening stops
+#define MAX_DEPTH 24			// deepest search a parameter file may ask for
+#define MAX_TIME 4				// seconds per move when the referee gives no time limit
+#define TIME_MARGIN 100			// milliseconds of the time limit kept in reserve
+#define WATCHDOG_MARGIN 30		// milliseconds before the time limit the watchdog answers for a late search
+#define PONDER_DEPTH 6			// depth of the search on rank 0 that predicts the reply of the opponent
+#define PONDER_OFF 0			// states of a search for poll_ponder
+#define PONDER_WAITING 1		// on the time of the opponent, no time limit
+#define PONDER_TIMED 2			// the opponent played the predicted move and gen_move came, timed as usual
+#define PONDER_MISS 3			// the referee sent something else, the search is of no use
+#define OPENING_SHARE 0.5		// share of the time limit planned for before opening_disks, unless the best move changed
+#define EBF_DEFAULT 4.0			// effective branching factor until two depths have been timed
+#define EBF_MIN 1.5
+#define EBF_MAX 8.0
+#define ENDGAME_EMPTIES 20		// solve exactly when this many squares or less are empty
+#define PNS_EMPTIES 24			// the last rank runs proof-number search when this many squares or less are empty
+#define PNS_MIN_RANKS 4			// master, two searching workers and the prover
+
+// Evaluation
+#define PATTERN_FILE "weights.bin"	// pattern weights, the hand written evaluation is used without it
+#define NNUE_FILE "nnue.bin"		// network, used before the patterns when it exists
+#define NNUE_STACK 64				// accumulators along the search path, deeper than any search
+
+// Multi-ProbCut
+#define PROBCUT_FILE "probcut.txt"	// written by: my_player calibrate <corpus> probcut.txt
+#define PROBCUT_PHASES 4			// game phases by number of disks on the board
+#define PROBCUT_MIN_DEPTH 3			// no cuts closer to the leaves than this
+#define PROBCUT_CONFIDENCE 1.5		// standard deviations the prediction must be outside the window
+#define NO_CUT 2000000				// returned when probcut or etc_cutoff make no cut
+
+// Search parameters and SPSA tuning
+#define PARAMS_FILE "params.txt"	// written by: my_player tune params.txt <iterations> <game pairs>
+#define TUNE_OPENING_PLIES 8		// random moves that start every self-play game
+#define TUNE_MOVE_TIME 1.0			// seconds per self-play move by default
+#define SPSA_RATE 1.0				// perturbations a parameter moves at the first iteration if one side wins every game
+#define SPSA_ALPHA 0.602			// decay of the step size
+#define SPSA_GAMMA 0.101			// decay of the perturbation
+
+// Transposition table
+#define HISTORY_MIN_DEPTH 2			// moves are ordered by history only this far from the leaves
+#define POLL_NODES 4096				// minimax nodes between checks for the timeout message
+#define TT_BITS 20					// 2^TT_BITS entries per process
+#define ETC_MIN_DEPTH 4				// Enhanced Transposition Cutoffs only this far from the leaves
+#define TT_EXACT 0
+#define TT_LOWER 1
+#define TT_UPPER 2
+#define EVAL_CACHE_BITS 16			// 2^EVAL_CACHE_BITS evaluations cached per process
+#define EVAL_BATCH PATTERN_BATCH	// children of a node one move from the leaves evaluated together
+#define TAPER_DISKS 8				// disks over which the weights of eval_position change from one phase to the next
 
 #define REQUEST_MOVE_TAG 0
 #define SEND_MOVE_TAG 1
 #define NO_MOVES_LEFT_TAG 2
 #define SEND_ALPHA_TAG 3
 #define TIMEOUT_TAG 4
+#define SEND_JOB_TAG 5
+#define CANCEL_JOB_TAG 6
+#define PROVEN_MOVE_TAG 7
+
+// Endgame jobs
+#define JOB_MSG_SIZE 7			// id, P (2 ints), O (2 ints), alpha, beta
+#define JOB_HELD 0				// a younger brother, waits until one of its brothers is solved
+#define JOB_WAITING 1
+#define JOB_RUNNING 2
+#define JOB_SPLIT 3				// its children are solved instead
+#define JOB_DONE 4
+#define ENDGAME_SPLIT_EMPTIES 16	// positions with more empty squares are split into their children
+#define ENDGAME_NODES 65536		// size of the tree endgame_master splits, when it is full no more positions are split
 
-// Stability stuff
-const int UNSTABLE 	 = 0;
-const int H_BORDER 	 = 1;
-const int V_BORDER 	 = 2;
-const int UDD_BORDER = 4; // up down diagional
-const int DUD_BORDER = 8;
-const int STABLE 	= 15;
-
-#define IS_UNSTABLE(type) 		(type == UNSTABLE)
-#define IS_H_BORDER(type) 		(type & H_BORDER)
-#define IS_V_BORDER(type) 		(type & V_BORDER)
-#define IS_UDD_BORDER(type) 	(type & UDD_BORDER)
-#define IS_DUD_BORDER(type) 	(type & DUD_BORDER)
-#define IS_STABLE(type) 		(type == STABLE)
-
-// When a loop is done in spiral for stability
-#define IS_LOOP_COMPLETED(loc)	(loc == 21 || loc == 32 || loc == 43 || loc == 54) 
-
-// Spiral used to iterate through stability board 
-const int spiral[64] = {	11, 12, 13, 14, 15, 16, 17, 18, 
-							28, 38, 48, 58, 68, 78, 88, 
-							87, 86, 85, 84, 83, 82, 81, 
-							71, 61, 51, 41, 31, 21,
-							
-							22, 23, 24, 25, 26, 27,
-							37, 47, 57, 67, 77,
-							76, 75, 74, 73, 72,
-							62, 52, 42, 32,
-
-							33, 34, 35, 36,
-							46, 56, 66,
-							65, 64, 63,
-							53, 43,
-
-							44, 45,
-							55, 54 
-						}; 
 // Static position evaluation for move ordering
 const int eval_board[90] = {0,  0,  0,  0,  0,  0,  0,  0,  0, 0,
 							0,  4, -3,  2,  2,  2,  2, -3,  4, 0,
@@ -92,9 +126,110 @@ const int BOARDSIZE = 100;
 const int LEGALMOVSBUFSIZE = 65;
 const char piecenames[4] = {'.','b','w','?'};
 
+// deep = a * shallow + b, with error sigma, from the point of view of the side to move
+typedef struct {
+	int shallow; // depth of the shallow search, 0 if there is no cut at this depth
+	double a;
+	double b;
+	double sigma;
+} probcut_t;
+
+// A search parameter, read from PARAMS_FILE and tuned by run_tune
+typedef struct {
+	const char *name;
+	int *value;
+	int min;
+	int max;
+	int step;		// perturbation of the tuner, 0 if it is not tuned
+} param_t;
+
+typedef struct {
+	unsigned long long key;
+	int value;		// from the point of view of max_colour
+	int flag;		// TT_EXACT, or the bound a lazy evaluation returned
+} eval_entry_t;
+
+typedef struct {
+	unsigned long long key;
+	int value;		// from the point of view of max_colour
+	char depth;
+	char flag;		// TT_EXACT, TT_LOWER or TT_UPPER
+	char move;		// best move found, 0 if none
+	unsigned char age;	// tt_age of the search that stored it
+} tt_entry_t;
+
+// Rank 0 answers the referee from a second thread when the search is late, see watchdog
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_t thread;
+	struct timespec deadline;	// CLOCK_MONOTONIC
+	int armed;			// waiting for the deadline of the current move
+	int move;			// best move known so far, -1 to pass
+	int sent;			// the watchdog has sent a move for the current move
+	int sent_move;		// the move it sent
+	int result;			// of comms_send_move when the watchdog sent it
+	int running;
+} watchdog_t;
+
+// Search on the time of the opponent, in the position after the reply it is expected to play
+typedef struct {
+	int active;			// strategy is pondering
+	int predicted;		// the expected reply
+	int hit;			// the opponent played it
+	int timed;			// and gen_move came after it
+	int pending;		// the referee sent a command the search cannot use, it is in cmd and move
+	int result;			// of comms_get_cmd for the pending command
+	double received;	// MPI_Wtime when the last command was read
+	char cmd[CMDBUFSIZE];
+	char move[MOVEBUFSIZE];
+} ponder_t;
+
+// The position being searched, kept up to date along the search path so the evaluation never scans the board
+typedef struct {
+	uint64_t P;			// disks of max_colour
+	uint64_t O;
+	uint64_t stable;	// stable disks of both colours, inner disks only up to the last full update
+	uint64_t moves;		// moves of the side to move, set when minimax generates them
+	unsigned long long key;	// Zobrist key of the disks, hash_board without the side to move
+	int discs[2];		// disks of max_colour and of the other side
+	int frontier[2];	// disks next to an empty square, of max_colour and of the other side
+	int ply;			// index of the network accumulators of the position in nnue_stack
+} path_t;
+
+// A position of the tree endgame_master splits, solved by one worker or split further
+typedef struct {
+	uint64_t P;		// disks of the side to move
+	uint64_t O;
+	int parent;		// index of the parent, -1 for the root
+	int move;		// loc of the move from the parent, -1 for a pass
+	int ply;		// distance from the root
+	int first;		// index of the first child, the children are consecutive
+	int children;
+	int left;		// children not solved yet
+	int value;		// best child value so far, from the side to move
+	int alpha;		// window from the side to move, see endgame_sweep
+	int beta;
+	int state;		// JOB_HELD, JOB_WAITING, JOB_RUNNING, JOB_SPLIT or JOB_DONE
+	int rank;		// worker solving it
+	int msg[JOB_MSG_SIZE];
+} endgame_job_t;
+
 void run_master(int argc, char *argv[]);
-int initialise_master(int argc, char *argv[], int *time_limit, int *my_colour, FILE **fp);
-void gen_move_master(char *move, int my_colour, FILE *fp);
+int initialise_master(int argc, char *argv[], double *time_limit, int *my_colour, FILE **fp);
+int gen_move_master(char *move, int my_colour, FILE *fp);
+void move_string(int loc, char *move);
+void *watchdog(void *arg);
+void watchdog_start();
+void watchdog_stop();
+void watchdog_arm(int loc);
+void watchdog_update(int loc);
+void watchdog_first(int loc);
+int watchdog_answer(int loc, int *result, FILE *fp);
+int ponder_master(int my_colour, char *cmd, char *opponent_move, FILE *fp);
+int predict_reply(int my_colour);
+int poll_ponder(FILE *fp);
+void ponder_command(FILE *fp);
 void apply_opp_move(char *move, int my_colour, FILE *fp);
 void game_over();
 void run_worker();
@@ -108,6 +243,8 @@ int would_flip(int move, int dir, int player, FILE *fp);
 int opponent(int player, FILE *fp);
 int find_bracket_piece(int square, int dir, int player, FILE *fp);
 int strategy(int my_colour, FILE *fp);
+double move_budget(double seconds, int changed);
+int next_depth_fits(double elapsed, double last, double before, double budget);
 void make_move(int move, int player, FILE *fp);
 void make_flips(int move, int dir, int player, FILE *fp);
 int get_loc(char* movestring);
@@ -116,22 +253,136 @@ void print_board(FILE *fp);
 char nameof(int piece);
 int count(int player, int * board);
 void copy_board(int *original, int *copy);
+void order_root_moves(int *moves, int *scores, int best);
 int minimax(int current_colour, int depth, int alpha, int beta);
+int probcut(int current_colour, int depth, int alpha, int beta);
+void load_probcut(char *filename);
+int probcut_shallow_depth(int depth);
+int probcut_phase();
+void run_calibrate(int argc, char *argv[]);
+int load_params(char *filename);
+int write_params(char *filename);
+void set_params(double *theta, int *delta, double scale);
+void build_eval_table();
+void run_tune(int argc, char *argv[]);
+void run_selfplay(int argc, char *argv[]);
+int random_move(int *moves, unsigned long long *state);
+double play_pair(unsigned long long seed, double *theta, int *delta, double c, double move_time);
+int self_play_move(int colour, double move_time);
+int read_position(char *line, int *colour);
+void initialise_tt();
+void clear_tt();
+void age_tt();
+void order_by_history(int current_colour, int *moves);
+void broadcast_search();
+int first_depth();
+int store_eval(eval_entry_t *entry, unsigned long long key, int value, int flag);
+int eval_children(unsigned long long key, int *moves, int current_colour, int alpha, int beta, int *best);
+void report_eval_cache(FILE *fp);
+unsigned long long hash_board(int current_colour);
+unsigned long long child_hash(unsigned long long key, int move, int player);
+tt_entry_t *probe_tt(unsigned long long key);
+void store_tt(unsigned long long key, int depth, int value, int flag, int move);
+int etc_cutoff(unsigned long long key, int *moves, int current_colour, int depth, int alpha, int beta);
+int check_timeout();
+int count_empties();
+void board_to_bitboards(int current_colour, uint64_t *P, uint64_t *O);
+void start_path();
+void advance_path(int move, int player);
+void path_moves(int current_colour, int *moves);
+int endgame_master(int my_colour, int *moves, FILE *fp);
+int endgame_split(endgame_job_t *jobs, int j, int *n_jobs, int *moves, int *best);
+void endgame_resolve(endgame_job_t *jobs, int j, int value, int *best);
+int endgame_sweep(endgame_job_t *jobs, int n_jobs, int alpha, int beta, int *best);
+void endgame_worker();
+int poll_endgame_job();
+int drain_messages(int *proven_move);
+void pns_worker(int my_colour);
+int poll_pns();
 
 int *board;
-clock_t start, end;
+double start;				// wall time, from MPI_Wtime, when the current move was asked for
+double time_limit = MAX_TIME;	// seconds per move, from the command line
+double deadline = 0;		// ends searches on this rank alone when set, in self-play
+watchdog_t watch;
+ponder_t ponder;
+int ponder_enabled = TRUE;
+int ponder_hits = 0, ponder_tries = 0;
+int predicting = FALSE;		// rank 0 is in predict_reply, a command from the referee ends it
 int max_colour;
 int timeout;
+unsigned long long nodes = 0;		// minimax nodes searched by this rank, for POLL_NODES
+probcut_t probcut_table[PROBCUT_PHASES][MAX_DEPTH+1];
+int probcut_enabled = FALSE;
+int in_probcut = FALSE;
+int current_job = -1;
+int job_cancelled = FALSE;
+int pns_stop = FALSE;
+unsigned long long zobrist[100][3];
+unsigned long long zobrist_side[3];
+tt_entry_t *tt;
+unsigned char tt_age = 0;
+int history[3][100];		// cutoffs of each move by colour, weighted by depth squared
+int search_depth;			// first depth of iterative deepening of the current search
+int completed_depth = 0;	// last depth the search that answered gen_move completed, 0 if none
+eval_entry_t *eval_cache;
+unsigned long long eval_probes = 0, eval_hits = 0;
+path_t path;
+nnue_acc_t nnue_stack[NNUE_STACK];
+
+int starting_depth = STARTING_MAX_DEPTH;
+int depth_limit = DEPTH_LIMIT;
+int time_margin = TIME_MARGIN;
+int opening_disks = 14;					// eval_position changes from the opening to the midgame weights around this
+int late_empties = STARTING_MAX_DEPTH;	// and from the midgame weights to parity alone around this many empties
+int lazy_mobility = 60;					// percent of the largest mobility term kept as the margin of lazy evaluation
+int eval_weights[2][5] = {{5, 30, 10, 20, 0}, {25, 30, 1, 25, 0}}; // parity, corners, mobility, stability, frontier (off); opening and midgame
+int eval_table[65][5];					// weights of eval_position by number of disks, see build_eval_table
+
+param_t params[] = {
+	{"starting_depth", &starting_depth, 1, MAX_DEPTH, 1},
+	{"depth_limit", &depth_limit, 1, MAX_DEPTH, 1},
+	{"time_margin", &time_margin, 0, 1000, 0},	// not tuned, self-play never loses on time
+	{"ponder", &ponder_enabled, 0, 1, 0},
+	{"opening_disks", &opening_disks, 4, 64, 2},
+	{"late_empties", &late_empties, 0, 30, 1},
+	{"lazy_mobility", &lazy_mobility, 0, 100, 5},
+	{"opening_parity", &eval_weights[0][0], 0, 200, 2},
+	{"opening_corners", &eval_weights[0][1], 0, 200, 5},
+	{"opening_mobility", &eval_weights[0][2], 0, 200, 2},
+	{"opening_stability", &eval_weights[0][3], 0, 200, 4},
+	{"opening_frontier", &eval_weights[0][4], 0, 200, 2},
+	{"midgame_parity", &eval_weights[1][0], 0, 200, 4},
+	{"midgame_corners", &eval_weights[1][1], 0, 200, 5},
+	{"midgame_mobility", &eval_weights[1][2], 0, 200, 1},
+	{"midgame_stability", &eval_weights[1][3], 0, 200, 4},
+	{"midgame_frontier", &eval_weights[1][4], 0, 200, 1}
+};
+const int n_params = sizeof(params) / sizeof(params[0]);
 
 int main(int argc, char *argv[]) {
-	int rank;
+	int rank, provided;
 
-	MPI_Init(&argc, &argv);
+	// Only the main thread calls MPI, the watchdog of rank 0 only uses the socket
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
  
 	initialise_board(); //one for each process
-
-	if (rank == 0) {
+	initialise_tt();
+	endgame_init();
+	pattern_load(PATTERN_FILE);
+	nnue_load(NNUE_FILE);
+	load_probcut(PROBCUT_FILE);
+	load_params(PARAMS_FILE);
+	build_eval_table();
+
+	if (argc >= 2 && strcmp(argv[1], "calibrate") == 0) {
+		run_calibrate(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "tune") == 0) {
+		run_tune(argc, argv);
+	} else if (argc >= 2 && strcmp(argv[1], "selfplay") == 0) {
+		run_selfplay(argc, argv);
+	} else if (rank == 0) {
 	    run_master(argc, argv);
 	} else {
 	    run_worker(rank);
@@ -143,13 +394,13 @@ void run_master(int argc, char *argv[]) {
 	char cmd[CMDBUFSIZE];
 	char my_move[MOVEBUFSIZE];
 	char opponent_move[MOVEBUFSIZE];
-	int time_limit;
 	int my_colour;
-	int running = 0;
+	int running = 0, result, pending = FALSE;
 	FILE *fp = NULL;
 
 	if (initialise_master(argc, argv, &time_limit, &my_colour, &fp) != FAILURE) {
 		running = 1;
+		watchdog_start();
 	}
 	if (my_colour == EMPTY) my_colour = BLACK;
 	// Broadcast my_colour
@@ -157,37 +408,49 @@ void run_master(int argc, char *argv[]) {
 	max_colour = my_colour;
 
 	while (running == 1) {
-		/* Receive next command from referee */
-		if (comms_get_cmd(cmd, opponent_move) == FAILURE) {
+		/* Receive next command from referee, unless pondering already did */
+		if (!pending && comms_get_cmd(cmd, opponent_move) == FAILURE) {
 			fprintf(fp, "Error getting cmd\n");
 			fflush(fp);
 			running = 0;
 			break;
 		}
+		pending = FALSE;
 
 		/* Received game_over message */
 		if (strcmp(cmd, "game_over") == 0) {
 			running = 0;
+			if (ponder_tries > 0) fprintf(fp, "Ponder hits: %d of %d\n", ponder_hits, ponder_tries);
 			fprintf(fp, "Game over\n");
 			fflush(fp);
 			break;
 
 		/* Received gen_move message */
 		} else if (strcmp(cmd, "gen_move") == 0) {
-			// Broadcast running
-			MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD);
-			// Broadcast board 
-			MPI_Bcast(board, BOARDSIZE, MPI_INT, 0, MPI_COMM_WORLD);
+			// After a ponder miss, gen_move came with the move of the opponent that stopped the search
+			start = ponder.pending ? ponder.received : MPI_Wtime();
+			watchdog_arm(-1);
+			broadcast_search();
 
-			gen_move_master(my_move, my_colour, fp);
+			result = gen_move_master(my_move, my_colour, fp);
+			report_eval_cache(fp);
 			print_board(fp);
 
-			if (comms_send_move(my_move) == FAILURE) {
+			if (result == FAILURE) {
 				running = 0;
 				fprintf(fp, "Move send failed\n");
 				fflush(fp);
 				break;
 			}
+
+			// Search on the time of the opponent until the referee needs something else
+			pending = ponder_enabled;
+			if (pending && ponder_master(my_colour, cmd, opponent_move, fp) == FAILURE) {
+				running = 0;
+				fprintf(fp, "Pondering failed\n");
+				fflush(fp);
+				break;
+			}
 		/* Received opponent's move (play_move mesage) */
 		} else if (strcmp(cmd, "play_move") == 0) {
 			apply_opp_move(opponent_move, my_colour, fp);
@@ -200,15 +463,16 @@ void run_master(int argc, char *argv[]) {
 	}
 	// Broadcast running
 	MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	watchdog_stop();
 }
 
-int initialise_master(int argc, char *argv[], int *time_limit, int *my_colour, FILE **fp) {
+int initialise_master(int argc, char *argv[], double *time_limit, int *my_colour, FILE **fp) {
 	int result = FAILURE;
 
 	if (argc == 5) { 
 		unsigned long ip = inet_addr(argv[1]);
 		int port = atoi(argv[2]);
-		*time_limit = atoi(argv[3]);
+		if (atof(argv[3]) > 0) *time_limit = atof(argv[3]);
 
 		*fp = fopen(argv[4], "w");
 		if (*fp != NULL) {
@@ -240,6 +504,11 @@ void initialise_board() {
 
 void free_board() {
 	free(board);
+	free(tt);
+	free(eval_cache);
+	endgame_free();
+	pns_free();
+	pattern_free();
 }
 
 /**
@@ -254,11 +523,12 @@ void run_worker() {
 	int no_moves_left;
 	int move, eval, flag;
 	int alpha, other_alpha;
-	int buffer;
-	int i, comm_sz, my_rank, depth;
+	int buffer[JOB_MSG_SIZE];
+	int result[3]; // completed flag, move, eval
+	int i, comm_sz, my_rank, depth, endgame, prover;
 	int *best_move = (int *) calloc(2, sizeof(int));
 	int *board_copy= (int *) calloc(BOARDSIZE, sizeof(int));
-	MPI_Request request;
+	MPI_Request request, result_request = MPI_REQUEST_NULL;
 	MPI_Status status;
 
 	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
@@ -273,11 +543,25 @@ void run_worker() {
 	while (running == 1) {
 		// Broadcast board
 		MPI_Bcast(board, BOARDSIZE, MPI_INT, 0, MPI_COMM_WORLD);
+		MPI_Bcast(&depth, 1, MPI_INT, 0, MPI_COMM_WORLD);
 		
 		copy_board(board, board_copy);
+		age_tt();
+		endgame = (count_empties() <= ENDGAME_EMPTIES);
+		prover = (!endgame && comm_sz >= PNS_MIN_RANKS && my_rank == comm_sz-1 && count_empties() <= PNS_EMPTIES);
 
-		depth = STARTING_MAX_DEPTH-1;
 		timeout = FALSE;
+
+		// Solve the position exactly together with the other workers
+		if (endgame) {
+			endgame_worker();
+			timeout = TRUE;
+		}
+		// Try to prove a win while the others search
+		if (prover) {
+			pns_worker(my_colour);
+			timeout = TRUE;
+		}
 	
 		// Iterative deepening loop
 		while (!timeout) {
@@ -286,8 +570,12 @@ void run_worker() {
 			alpha = -1000000;
 			no_moves_left = FALSE;
 
-			// request a move from master; also send 0 because a move evaluation has been completed
-			MPI_Isend(&FALSE, 1, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &request); 
+			// request a move from master; also send 0 because no move evaluation has been completed
+			MPI_Wait(&result_request, MPI_STATUS_IGNORE);
+			result[0] = FALSE;
+			result[1] = -1;
+			result[2] = 0;
+			MPI_Isend(result, 3, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &result_request); 
 			while (!no_moves_left && !timeout) { 
 				// Wait for message from master
 				MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
@@ -297,6 +585,7 @@ void run_worker() {
 						
 						// Evaluating the move 
 						make_move(move, my_colour, NULL);
+						start_path();
 						eval = minimax(opponent(my_colour, NULL), depth, alpha, 1000000);
 						if (timeout) break;
 						copy_board(board_copy, board);
@@ -312,8 +601,12 @@ void run_worker() {
 								MPI_Isend(&alpha, 1, MPI_INT, i, SEND_ALPHA_TAG, MPI_COMM_WORLD, &request);
 							}
 						}
-						// Request move when done; also send 1 because a move evaluation has been completed
-						MPI_Isend(&TRUE, 1, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &request);
+						// Request move when done; also send 1 and the score so master can reorder root moves
+						MPI_Wait(&result_request, MPI_STATUS_IGNORE);
+						result[0] = TRUE;
+						result[1] = move;
+						result[2] = eval;
+						MPI_Isend(result, 3, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &result_request);
 						break;
 					
 					case SEND_ALPHA_TAG: 
@@ -330,6 +623,10 @@ void run_worker() {
 					case TIMEOUT_TAG: 
 						MPI_Recv(&timeout, 1, MPI_INT, 0, TIMEOUT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 						break;
+
+					default: // left over from an earlier turn
+						MPI_Recv(buffer, JOB_MSG_SIZE, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+						break;
 				}
 			}    
 			// Barrier to make sure I catch all unreceived sends
@@ -339,7 +636,7 @@ void run_worker() {
 			while (flag) { 
 				MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
 				if (flag) {
-					MPI_Recv(&buffer, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+					MPI_Recv(buffer, JOB_MSG_SIZE, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 					if (status.MPI_TAG == TIMEOUT_TAG) { // If one happens to timeout, set vairaible
 						timeout = TRUE;
 					}
@@ -349,6 +646,8 @@ void run_worker() {
 			MPI_Gather(best_move, 2, MPI_INT, NULL, 0, MPI_INT, 0, MPI_COMM_WORLD); // send best move and eval
 			depth++;
 		}
+		MPI_Wait(&result_request, MPI_STATUS_IGNORE);
+		report_eval_cache(NULL);
 		// Broadcast running
 		MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD); 
 	}
@@ -363,22 +662,293 @@ void run_worker() {
  *  - gen_move_master should play minimax from its move(s)
  *  - the ranks may communicate during execution 
  *  - final results should be gathered at rank 0 for final selection of a move 
+ *  - the move is sent to the referee here, unless the watchdog already sent one,
+ *    returns the result of sending it
  */
-void gen_move_master(char *move, int my_colour, FILE *fp) {
-	int loc;
+int gen_move_master(char *move, int my_colour, FILE *fp) {
+	int loc, result;
 
 	/* generate move */
 	loc = strategy(my_colour, fp);
+	loc = watchdog_answer(loc, &result, fp);
+	move_string(loc, move);
+	if (loc != -1) {
+		/* apply move */
+		make_move(loc, my_colour, fp);
+	}
+	return result;
+}
 
+void move_string(int loc, char *move) {
 	if (loc == -1) {
 		strncpy(move, "pass\n", MOVEBUFSIZE);
 	} else {
-		/* apply move */
 		get_move_string(loc, move);
-		make_move(loc, my_colour, fp);
 	}
 }
 
+/**
+ *  Rank 0 executes this code: 
+ *  --------------------------
+ *  Called after our move was sent, searches on the time of the opponent
+ *  - The position searched is the one after the reply predict_reply expects,
+ *    with the workers and iterative deepening as for gen_move, but without a
+ *    time limit until the referee asks for our move
+ *  - If the opponent plays that reply, the search goes on and gen_move starts
+ *    its clock, deeper than a new search would get; then it ponders again
+ *  - Anything else stops the search, the real position is restored and the
+ *    command is left in cmd and opponent_move for run_master
+ *  - Returns FAILURE if talking to the referee failed
+ */
+int ponder_master(int my_colour, char *cmd, char *opponent_move, FILE *fp) {
+	int *real = (int *) calloc(BOARDSIZE, sizeof(int));
+	int loc, result, completed = completed_depth;
+
+	memset(&ponder, 0, sizeof(ponder));
+	copy_board(board, real);
+	// The endgame solver is not timed like strategy, and without a reply there is nothing to predict
+	while (count_empties() - 1 > ENDGAME_EMPTIES) {
+		ponder.predicted = predict_reply(my_colour);
+		if (ponder.predicted == -1) break;
+		make_move(ponder.predicted, opponent(my_colour, NULL), NULL);
+		ponder.active = TRUE;
+		ponder_tries++;
+
+		broadcast_search();
+		loc = strategy(my_colour, fp);
+		report_eval_cache(fp);
+		// The search may have ended before the referee spoke
+		while (!ponder.pending && !ponder.timed) ponder_command(fp);
+		ponder.active = FALSE;
+		if (!ponder.timed) {
+			// Its depth says nothing about the real position
+			completed_depth = completed;
+			break;
+		}
+		completed = completed_depth;
+
+		loc = watchdog_answer(loc, &result, fp);
+		if (loc != -1) make_move(loc, my_colour, fp);
+		print_board(fp);
+		if (result == FAILURE) {
+			free(real);
+			return FAILURE;
+		}
+		memset(&ponder, 0, sizeof(ponder));
+		copy_board(board, real);
+	}
+	copy_board(real, board);
+	free(real);
+	if (ponder.pending) {
+		strncpy(cmd, ponder.cmd, CMDBUFSIZE);
+		strncpy(opponent_move, ponder.move, MOVEBUFSIZE);
+		return ponder.result;
+	}
+	return comms_get_cmd(cmd, opponent_move);
+}
+
+/**
+ *   Reply the opponent is expected to play, -1 if it has none
+ *   - A search of PONDER_DEPTH on rank 0 alone, from the point of view of the opponent
+ *   - Gives up with -1 as soon as the referee sends a command, see check_timeout,
+ *     so the clock of gen_move starts when it arrives
+ */
+int predict_reply(int my_colour) {
+	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	int *board_copy = (int *) calloc(BOARDSIZE, sizeof(int));
+	int i, eval, alpha = -1000000, best = -1, other = opponent(my_colour, NULL);
+
+	legal_moves(other, moves, NULL);
+	max_colour = other;
+	clear_tt();
+	copy_board(board, board_copy);
+	timeout = FALSE;
+	predicting = TRUE;
+	for (i = 1; i <= moves[0] && !timeout; i++) {
+		make_move(moves[i], other, NULL);
+		start_path();
+		eval = minimax(my_colour, PONDER_DEPTH - 1, alpha, 1000000);
+		copy_board(board_copy, board);
+		if (eval > alpha) {
+			alpha = eval;
+			best = moves[i];
+		}
+	}
+	predicting = FALSE;
+	if (timeout) best = -1;
+	timeout = FALSE;
+	// The hit rate report_eval_cache writes is the one of the workers
+	eval_probes = 0;
+	eval_hits = 0;
+	max_colour = my_colour;
+	free(moves);
+	free(board_copy);
+	return best;
+}
+
+/**
+ *   Called by strategy, returns the ponder state of the search
+ *   - Reads a command from the referee when one is waiting, without blocking
+ */
+int poll_ponder(FILE *fp) {
+	if (!ponder.active) return PONDER_OFF;
+	if (!ponder.pending && !ponder.timed && comms_poll()) ponder_command(fp);
+	if (ponder.pending) return PONDER_MISS;
+	return ponder.timed ? PONDER_TIMED : PONDER_WAITING;
+}
+
+/**
+ *   Reads a command from the referee while pondering
+ *   - The predicted reply is a hit, gen_move after it starts the clock
+ *   - Anything else is kept for run_master
+ */
+void ponder_command(FILE *fp) {
+	ponder.result = comms_get_cmd(ponder.cmd, ponder.move);
+	ponder.received = MPI_Wtime();
+	if (ponder.result != FAILURE && !ponder.hit && strcmp(ponder.cmd, "play_move") == 0 &&
+		strcmp(ponder.move, "pass\n") != 0 && get_loc(ponder.move) == ponder.predicted) {
+		ponder.hit = TRUE;
+		ponder_hits++;
+		fprintf(fp, "Ponder hit: %d (%d of %d)\n", ponder.predicted, ponder_hits, ponder_tries);
+	} else if (ponder.result != FAILURE && ponder.hit && strcmp(ponder.cmd, "gen_move") == 0) {
+		start = ponder.received;
+		watchdog_arm(watch.move);
+		ponder.timed = TRUE;
+	} else {
+		if (!ponder.hit) fprintf(fp, "Ponder miss: %d (%d of %d)\n", ponder.predicted, ponder_hits, ponder_tries);
+		ponder.pending = TRUE;
+	}
+	fflush(fp);
+}
+
+/**
+ *  Rank 0 executes this code, in a thread of its own:
+ *  --------------------------
+ *  Sends the best move known so far when the search has not answered by the deadline
+ *  - Armed when gen_move arrives, the deadline is WATCHDOG_MARGIN before the time limit
+ *  - The search keeps the move up to date, whatever it is waiting for (a worker
+ *    deep in minimax, the barrier of strategy) the referee gets it on time
+ *  - The search then finishes as usual, which brings the workers back in step,
+ *    and the move the watchdog sent is the one played
+ */
+void *watchdog(void *arg) {
+	char move[MOVEBUFSIZE];
+
+	pthread_mutex_lock(&watch.lock);
+	while (watch.running) {
+		if (!watch.armed) {
+			pthread_cond_wait(&watch.wake, &watch.lock);
+		} else if (pthread_cond_timedwait(&watch.wake, &watch.lock, &watch.deadline) == ETIMEDOUT && watch.armed) {
+			move_string(watch.move, move);
+			watch.result = comms_send_move(move);
+			watch.sent_move = watch.move;
+			watch.sent = TRUE;
+			watch.armed = FALSE;
+		}
+	}
+	pthread_mutex_unlock(&watch.lock);
+	return NULL;
+}
+
+void watchdog_start() {
+	pthread_condattr_t attr;
+
+	pthread_mutex_init(&watch.lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&watch.wake, &attr);
+	pthread_condattr_destroy(&attr);
+	watch.armed = FALSE;
+	watch.running = TRUE;
+	pthread_create(&watch.thread, NULL, watchdog, NULL);
+}
+
+void watchdog_stop() {
+	if (!watch.running) return;
+	pthread_mutex_lock(&watch.lock);
+	watch.running = FALSE;
+	pthread_cond_signal(&watch.wake);
+	pthread_mutex_unlock(&watch.lock);
+	pthread_join(watch.thread, NULL);
+}
+
+/**
+ *   Starts the watch over the current move, start must be set
+ *   - loc is the best move known so far, -1 before the search starts
+ */
+void watchdog_arm(int loc) {
+	double remaining = time_limit - WATCHDOG_MARGIN / 1000.0 - (MPI_Wtime() - start);
+
+	if (!watch.running) return;
+	pthread_mutex_lock(&watch.lock);
+	clock_gettime(CLOCK_MONOTONIC, &watch.deadline);
+	if (remaining < 0) remaining = 0;
+	watch.deadline.tv_sec += (time_t) remaining;
+	watch.deadline.tv_nsec += (long) ((remaining - floor(remaining)) * 1e9);
+	if (watch.deadline.tv_nsec >= 1000000000L) {
+		watch.deadline.tv_sec++;
+		watch.deadline.tv_nsec -= 1000000000L;
+	}
+	watch.move = loc;
+	watch.sent = FALSE;
+	watch.armed = TRUE;
+	pthread_cond_signal(&watch.wake);
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/**
+ *   The search found a better move, or the first legal one
+ *   - Ignored once the watchdog has sent a move
+ */
+void watchdog_update(int loc) {
+	if (!watch.running || loc == -1) return;
+	pthread_mutex_lock(&watch.lock);
+	if (!watch.sent) watch.move = loc;
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/**
+ *   First legal move at the start of a search, -1 if there is none,
+ *   replaces what the search before left
+ *   - Ignored once the watchdog has sent a move
+ */
+void watchdog_first(int loc) {
+	if (!watch.running) return;
+	pthread_mutex_lock(&watch.lock);
+	if (!watch.sent) watch.move = loc;
+	pthread_mutex_unlock(&watch.lock);
+}
+
+/**
+ *   Sends loc to the referee unless the watchdog already sent a move,
+ *   returns the move that was sent
+ *   - The move is over, a search on the time of the opponent may update the
+ *     watchdog again before the next watchdog_arm
+ *   - Without a watchdog (self-play has no referee) loc is sent as is
+ */
+int watchdog_answer(int loc, int *result, FILE *fp) {
+	char move[MOVEBUFSIZE];
+
+	if (!watch.running) {
+		move_string(loc, move);
+		*result = comms_send_move(move);
+		return loc;
+	}
+	pthread_mutex_lock(&watch.lock);
+	if (watch.sent) {
+		fprintf(fp, "Watchdog sent %d, the search found %d\n", watch.sent_move, loc);
+		loc = watch.sent_move;
+		*result = watch.result;
+	} else {
+		watch.armed = FALSE;
+		move_string(loc, move);
+		*result = comms_send_move(move);
+	}
+	watch.sent = FALSE;
+	pthread_mutex_unlock(&watch.lock);
+	return loc;
+}
+
 void apply_opp_move(char *move, int my_colour, FILE *fp) {
 	int loc;
 	if (strcmp(move, "pass\n") == 0) {
@@ -458,7 +1028,8 @@ int find_bracket_piece(int square, int dir, int player, FILE *fp) {
 int opponent(int player, FILE *fp) {
 	if (player == BLACK) return WHITE;
 	if (player == WHITE) return BLACK;
-	fprintf(fp, "illegal player\n"); return EMPTY;
+	if (fp != NULL) fprintf(fp, "illegal player\n");
+	return EMPTY;
 }
 
 /**
@@ -470,18 +1041,18 @@ int opponent(int player, FILE *fp) {
  */
 int strategy(int my_colour, FILE *fp) {
 	int i, j, a = 0, requests, moves_completed, depth;
-	int comm_sz, flag, buffer;
+	int comm_sz, flag, buffer[3], state, stop;
+	int proven_move = -1;
 	int best_move[2] = {-1, -1000000};
+	int depth_best[2];
 	int *best_moves;
 	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
-	double time_spent = 0, time_spent_on_depth = 0;
-	clock_t temp_start;
+	int *scores = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	double time_spent = 0, time_spent_on_depth = 0, last_depth_time = 0;
+	double depth_start;
 	MPI_Status status;
 	MPI_Request request;
 
-	// start timer for iterative deepening
-	start = clock(); 
-
 	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
 	best_moves = (int *) calloc(comm_sz*2, sizeof(int));
 
@@ -497,15 +1068,24 @@ int strategy(int my_colour, FILE *fp) {
 			}
 		}
 	}	
-	depth = STARTING_MAX_DEPTH-1;
+	watchdog_first(moves[0] > 0 ? moves[1] : -1);
+	depth = search_depth;
+	completed_depth = 0;
 	timeout = FALSE;
+	// Workers solve the position exactly instead
+	if (count_empties() <= ENDGAME_EMPTIES) {
+		best_move[0] = endgame_master(my_colour, moves, fp);
+		timeout = TRUE;
+	}
 	// Iterative deepening loop
 	while (!timeout) {
 		requests = 0;
 		moves_completed = 0;
+		stop = FALSE;
+		for (i = 1; i <= moves[0]; i++) scores[i] = -1000000;
 
 		// Start timer to find time taken at this depth
-		temp_start = clock();
+		depth_start = MPI_Wtime();
 
 		// This loop dynamicly allocates moves to processes
 		while (moves_completed < moves[0] && !timeout && moves[0] > 1) { // exit only when all moves have been EVALUATED or timeout
@@ -513,33 +1093,51 @@ int strategy(int my_colour, FILE *fp) {
 			MPI_Iprobe(MPI_ANY_SOURCE, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &flag, &status); // look for move request
 			if (flag) {
 				// receive move request
-				MPI_Recv(&buffer, 1, MPI_INT, status.MPI_SOURCE, REQUEST_MOVE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-				moves_completed += buffer; // If buffer == 1 then evaluation of a move has been completed
+				MPI_Recv(buffer, 3, MPI_INT, status.MPI_SOURCE, REQUEST_MOVE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				moves_completed += buffer[0]; // If buffer[0] == 1 then evaluation of a move has been completed
+				if (buffer[0]) {
+					// keep the score of the completed move for reordering
+					for (i = 1; i <= moves[0]; i++) {
+						if (moves[i] == buffer[1]) scores[i] = buffer[2];
+					}
+				}
 				requests++;
 				if (requests <= moves[0]) {
 					// send move
 					MPI_Isend(&moves[requests], 1, MPI_INT, status.MPI_SOURCE, SEND_MOVE_TAG, MPI_COMM_WORLD, &request); // send unevaluated move
 				} 
 			}
-			end = clock();
-			time_spent = (double)(end - start) / CLOCKS_PER_SEC;
-			// If all moves have been evaluated and the time taken at current depth
-			// is less than the time remaining, then going deeper is pointless
-			if (moves_completed >= moves[0]) {
-				end = clock();
-				time_spent_on_depth = (double)(end - temp_start) / CLOCKS_PER_SEC;
-				if (time_spent_on_depth + time_spent >= MAX_TIME-0.1) {
-					depth = MAX_DEPTH; // Set to enter following if statement
+			// probe for a win proven by the prover rank
+			MPI_Iprobe(MPI_ANY_SOURCE, PROVEN_MOVE_TAG, MPI_COMM_WORLD, &flag, &status);
+			if (flag) {
+				MPI_Recv(&proven_move, 1, MPI_INT, status.MPI_SOURCE, PROVEN_MOVE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				watchdog_update(proven_move);
+				fprintf(fp, "Proven win: %d\n", proven_move);
+			}
+			// While pondering the clock only starts with gen_move
+			state = poll_ponder(fp);
+			time_spent = MPI_Wtime() - start;
+			// If all moves have been evaluated and the next depth is not expected
+			// to finish in the time planned for this move, going deeper is pointless
+			if (moves_completed >= moves[0] && state != PONDER_WAITING) {
+				time_spent_on_depth = MPI_Wtime() - depth_start;
+				for (i = 2, j = 1; i <= moves[0]; i++) {
+					if (scores[i] > scores[j]) j = i;
+				}
+				if (!next_depth_fits(time_spent, time_spent_on_depth, last_depth_time, move_budget(time_limit, j != 1))) {
+					stop = TRUE;
 				}
 			}
 			// Check cut off time for iterative deeping
-			if (time_spent > MAX_TIME-0.1 || depth >= MAX_DEPTH) { // also cap depth
+			if ((state != PONDER_WAITING && time_spent > time_limit - time_margin / 1000.0) || state == PONDER_MISS ||
+				stop || depth >= depth_limit || proven_move != -1) { // also cap depth, stop on a proven win
 				for (i = 1; i < comm_sz; i++) { 
 					MPI_Isend(&TRUE, 1, MPI_INT, i, TIMEOUT_TAG, MPI_COMM_WORLD, &request);
 				}
 				timeout = TRUE;
 			}
 		}
+		if (moves_completed >= moves[0] && moves[0] > 1) completed_depth = depth;
 		// If there is only 0 or 1 moves, we skip the process above
 		if (moves[0] <= 1) {
 			for (i = 1; i < comm_sz; i++) { 
@@ -555,36 +1153,546 @@ int strategy(int my_colour, FILE *fp) {
 		}
 		// Barrier to make sure I catch all unreceived sends
 		MPI_Barrier(MPI_COMM_WORLD);
-		// catch unreceived message
-		flag = TRUE; 
-		while (flag) {
-			MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
-			if (flag) {
-				MPI_Recv(&buffer, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-			}
-		}
+		// catch unreceived message, a win proven after the loop above ended among them
+		i = proven_move;
+		drain_messages(&proven_move);
+		if (proven_move != i) fprintf(fp, "Proven win: %d\n", proven_move);
 		// revceive best move from each worker
 		MPI_Gather(MPI_IN_PLACE, 2, MPI_INT, best_moves, 2, MPI_INT, 0, MPI_COMM_WORLD); 
 		// get best move
+		depth_best[0] = -1;
+		depth_best[1] = -1000000;
 		for (i = 2; i < comm_sz*2; i+=2) { //index 0 and 1 are for master process;
 			if (best_moves[i] == -1) continue; 
 			if (best_moves[i+1] > best_move[1]) {
 				best_move[0] = best_moves[i];
 				best_move[1] = best_moves[i+1];
 			}
+			if (best_moves[i+1] > depth_best[1]) {
+				depth_best[0] = best_moves[i];
+				depth_best[1] = best_moves[i+1];
+			}
 		}
+		watchdog_update(proven_move != -1 ? proven_move : best_move[0]);
+		// Reorder moves for the next depth using the scores of this depth
+		if (!timeout) order_root_moves(moves, scores, depth_best[0]);
+		last_depth_time = time_spent_on_depth;
 		depth++;
 	}
+	// a proven win overrides the search
+	if (proven_move != -1) best_move[0] = proven_move;
 	// failsafe for if time runs out before best move can be calculated
 	if (moves[0] != 0 && best_move[0] == -1) {
 		best_move[0] = moves[1];
 	}
 	if (moves[0] == 1) best_move[0] = moves[1];
+	if (completed_depth > 0) fprintf(fp, "Depths %d to %d completed\n", search_depth, completed_depth);
 	free(moves);
+	free(scores);
 	free(best_moves);
 	return(best_move[0]);
 }
 
+/**
+ *   Rank 0 executes this code
+ *   ----------------------------------
+ *   Starts a search on all ranks: running, the board and the first depth
+ */
+void broadcast_search() {
+	int running = 1;
+
+	search_depth = first_depth();
+	MPI_Bcast(&running, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Bcast(board, BOARDSIZE, MPI_INT, 0, MPI_COMM_WORLD);
+	MPI_Bcast(&search_depth, 1, MPI_INT, 0, MPI_COMM_WORLD);
+}
+
+/**
+ *   First depth of iterative deepening
+ *   - Two plies were played since the last search, the tables the workers
+ *     kept hold its completed depth minus two, so the shallower depths
+ *     would only repeat it
+ */
+int first_depth() {
+	int depth = completed_depth - 2;
+
+	if (depth < starting_depth - 1) depth = starting_depth - 1;
+	if (depth > depth_limit - 1) depth = depth_limit - 1;
+	return depth;
+}
+
+/**
+ *   Seconds iterative deepening may plan to use for a move of seconds
+ *   ----------------------------------
+ *   - The whole time less the reserve in the midgame, where moves decide games
+ *   - OPENING_SHARE of it in the opening, unless the best move changed at the
+ *     last depth, which shows the position is not settled yet
+ *   - Searches still stop only at the whole time, this is for starting a new depth
+ */
+double move_budget(double seconds, int changed) {
+	double budget = seconds - time_margin / 1000.0;
+
+	if (!changed && 64 - count_empties() < opening_disks) budget *= OPENING_SHARE;
+	return budget;
+}
+
+/**
+ *   Whether the next depth is expected to finish within budget seconds of the move
+ *   - last and before are the times of the last two depths, their ratio is
+ *     the effective branching factor, within EBF_MIN..EBF_MAX since short depths are noisy
+ */
+int next_depth_fits(double elapsed, double last, double before, double budget) {
+	double ebf = before > 0.001 ? last / before : EBF_DEFAULT;
+
+	if (ebf < EBF_MIN) ebf = EBF_MIN;
+	if (ebf > EBF_MAX) ebf = EBF_MAX;
+	return elapsed + last * ebf <= budget;
+}
+
+/**
+ *  Rank 0 executes this code: 
+ *  --------------------------
+ *  Called instead of iterative deepening when ENDGAME_EMPTIES or less squares are empty
+ *  - Master keeps a tree of the positions it split, the leaves are jobs handed
+ *    out as workers ask, a worker solves a job with endgame_solve
+ *  - The root and the root moves are always split, so every reply to every root
+ *    move is searched at once; below that a position is split while it has more
+ *    than ENDGAME_SPLIT_EMPTIES empty squares, so no job is much larger than the others
+ *  - Below the replies the first child of a split position is solved before its
+ *    brothers are handed out (young brothers wait), the windows they get are
+ *    narrower for it
+ *  - A position is settled as soon as one child refutes it, jobs below it are cancelled
+ *  - First a win/loss/draw pass with window (-1, 1): a proven win or draw stops
+ *    every rank at once. Only if every move loses, the exact losing score is searched
+ */
+int endgame_master(int my_colour, int *moves, FILE *fp) {
+	endgame_job_t *jobs = (endgame_job_t *) calloc(ENDGAME_NODES, sizeof(endgame_job_t));
+	int *idle;
+	int i, j, n_jobs, n_idle = 0;
+	int comm_sz, flag, buffer[3], stage;
+	int alpha = -65, window_alpha, window_beta, best = -1;
+	double time_spent;
+	MPI_Status status;
+	MPI_Request request;
+
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+	idle = (int *) calloc(comm_sz, sizeof(int));
+
+	for (stage = 0; stage < 2 && !timeout && moves[0] > 1; stage++) {
+		if (stage == 0) {
+			window_alpha = -1;
+			window_beta = 1;
+		} else {
+			// a win or draw was found, nothing left to search
+			if (alpha >= 0) break;
+			window_alpha = -65;
+			window_beta = 0;
+		}
+		// The tree starts again from the root, the workers keep their hash tables
+		memset(jobs, 0, sizeof(endgame_job_t));
+		board_to_bitboards(my_colour, &jobs[0].P, &jobs[0].O);
+		jobs[0].parent = -1;
+		jobs[0].move = -1;
+		jobs[0].value = -65;
+		jobs[0].state = JOB_WAITING;
+		n_jobs = 1;
+		endgame_split(jobs, 0, &n_jobs, moves, &best);
+		endgame_sweep(jobs, n_jobs, window_alpha, window_beta, &best);
+
+		while (jobs[0].state != JOB_DONE && !timeout) {
+			// Hand out waiting jobs to idle workers, the deepest first, splitting those too large
+			while (n_idle > 0) {
+				j = -1;
+				for (i = 1; i < n_jobs; i++) {
+					if (jobs[i].state == JOB_WAITING && (j == -1 || jobs[i].ply > jobs[j].ply)) j = i;
+				}
+				if (j == -1) break;
+				if ((jobs[j].ply < 2 || 64 - bit_count(jobs[j].P | jobs[j].O) > ENDGAME_SPLIT_EMPTIES) &&
+					endgame_split(jobs, j, &n_jobs, NULL, &best)) {
+					endgame_sweep(jobs, n_jobs, window_alpha, window_beta, &best);
+					continue;
+				}
+				n_idle--;
+				jobs[j].state = JOB_RUNNING;
+				jobs[j].rank = idle[n_idle];
+				jobs[j].msg[0] = 2 * j + stage;
+				jobs[j].msg[1] = (int) (jobs[j].P >> 32);
+				jobs[j].msg[2] = (int) jobs[j].P;
+				jobs[j].msg[3] = (int) (jobs[j].O >> 32);
+				jobs[j].msg[4] = (int) jobs[j].O;
+				jobs[j].msg[5] = jobs[j].alpha;
+				jobs[j].msg[6] = jobs[j].beta;
+				MPI_Isend(jobs[j].msg, JOB_MSG_SIZE, MPI_INT, jobs[j].rank, SEND_JOB_TAG, MPI_COMM_WORLD, &request);
+			}
+
+			// Results come with the request for the next job
+			MPI_Iprobe(MPI_ANY_SOURCE, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &flag, &status);
+			if (flag) {
+				MPI_Recv(buffer, 3, MPI_INT, status.MPI_SOURCE, REQUEST_MOVE_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				idle[n_idle++] = status.MPI_SOURCE;
+				// Results of cancelled jobs or of the previous stage are ignored
+				j = buffer[1] / 2;
+				if (buffer[0] && buffer[1] % 2 == stage && j < n_jobs && jobs[j].state == JOB_RUNNING) {
+					endgame_resolve(jobs, j, buffer[2], &best);
+					endgame_sweep(jobs, n_jobs, window_alpha, window_beta, &best);
+				}
+			}
+
+			time_spent = MPI_Wtime() - start;
+			if (time_spent > time_limit - time_margin / 1000.0) timeout = TRUE;
+		}
+		alpha = jobs[0].value;
+	}
+
+	// Stop all workers
+	for (i = 1; i < comm_sz; i++) { 
+		MPI_Isend(&TRUE, 1, MPI_INT, i, TIMEOUT_TAG, MPI_COMM_WORLD, &request);
+	}
+	timeout = TRUE;
+	MPI_Barrier(MPI_COMM_WORLD);
+	drain_messages(NULL);
+
+	if (moves[0] > 1 && jobs[0].state == JOB_DONE) {
+		fprintf(fp, "Endgame solved: %d (%s)\n", alpha, alpha > 0 ? "win" : (alpha == 0 ? "draw" : "loss"));
+	} else if (moves[0] > 1) {
+		fprintf(fp, "Endgame not solved in time\n");
+	}
+	if (best == -1 && moves[0] > 0) best = moves[1];
+	free(jobs);
+	free(idle);
+	return best;
+}
+
+/**
+ *   Called by endgame_master, makes the children of job j
+ *   - moves are the root moves in the order strategy gave them, NULL below the
+ *     root, where the children are sorted by the moves they leave the opponent
+ *   - A side without moves passes, a child where the game is over is solved at once
+ *   - Returns FALSE, leaving j a job, if the tree has no room for the children
+ */
+int endgame_split(endgame_job_t *jobs, int j, int *n_jobs, int *moves, int *best) {
+	endgame_job_t *child, swap;
+	uint64_t todo = get_moves(jobs[j].P, jobs[j].O), flips;
+	int i, k, sq, m, n = 0, mobility[64];
+
+	if (*n_jobs + 64 > ENDGAME_NODES) return FALSE;
+	jobs[j].state = JOB_SPLIT;
+	jobs[j].first = *n_jobs;
+	for (i = 1; todo != 0 || n == 0; i++) {
+		child = &jobs[*n_jobs + n];
+		memset(child, 0, sizeof(endgame_job_t));
+		if (moves != NULL) {
+			if (i > moves[0]) break;
+			child->move = moves[i];
+			sq = 8 * (moves[i] / 10 - 1) + moves[i] % 10 - 1;
+		} else if (todo != 0) {
+			sq = __builtin_ctzll(todo);
+			child->move = 10 * (sq / 8 + 1) + sq % 8 + 1;
+		} else {
+			sq = -1;
+			child->move = -1;
+		}
+		if (sq >= 0) {
+			todo &= ~BIT(sq);
+			flips = get_flips(sq, jobs[j].P, jobs[j].O);
+			child->P = jobs[j].O ^ flips;
+			child->O = jobs[j].P ^ flips ^ BIT(sq);
+		} else {
+			child->P = jobs[j].O;
+			child->O = jobs[j].P;
+		}
+		child->parent = j;
+		child->ply = jobs[j].ply + 1;
+		child->value = -65;
+		child->state = JOB_WAITING;
+		mobility[n] = bit_count(get_moves(child->P, child->O));
+		// Fastest first, insertion sort on the moves left to the opponent
+		for (k = n; moves == NULL && k > 0 && mobility[k - 1] > mobility[k]; k--) {
+			swap = jobs[*n_jobs + k];
+			m = mobility[k];
+			jobs[*n_jobs + k] = jobs[*n_jobs + k - 1];
+			jobs[*n_jobs + k - 1] = swap;
+			mobility[k] = mobility[k - 1];
+			mobility[k - 1] = m;
+		}
+		n++;
+	}
+	jobs[j].children = n;
+	jobs[j].left = n;
+	*n_jobs += n;
+
+	for (k = jobs[j].first; k < *n_jobs; k++) {
+		// Younger brothers wait below the replies to the root moves
+		if (k > jobs[j].first && jobs[j].ply >= 2) jobs[k].state = JOB_HELD;
+		if (get_moves(jobs[k].P, jobs[k].O) == 0 && get_moves(jobs[k].O, jobs[k].P) == 0) {
+			endgame_resolve(jobs, k, final_score(jobs[k].P, jobs[k].O), best);
+		}
+	}
+	return TRUE;
+}
+
+/**
+ *   Called by endgame_master when job j is solved, value is from its side to move
+ *   - The parent keeps the best value of its children, one solved child lets
+ *     the younger brothers go
+ *   - best is the root move of the best value of the root
+ */
+void endgame_resolve(endgame_job_t *jobs, int j, int value, int *best) {
+	int p = jobs[j].parent, k;
+
+	jobs[j].state = JOB_DONE;
+	jobs[j].value = value;
+	if (p == -1) return;
+	if (-value > jobs[p].value) {
+		jobs[p].value = -value;
+		if (p == 0) {
+			*best = jobs[j].move;
+			watchdog_update(*best);
+		}
+	}
+	jobs[p].left--;
+	for (k = jobs[p].first; k < jobs[p].first + jobs[p].children; k++) {
+		if (jobs[k].state == JOB_HELD) jobs[k].state = JOB_WAITING;
+	}
+}
+
+/**
+ *   Called by endgame_master whenever a job was solved or split
+ *   - Parents come before their children, so one pass from the root passes the
+ *     windows down: a child gets the window of its parent negated, raised to its own best value
+ *   - A split position is solved when all its children are, or when one child
+ *     reaches beta; jobs below a solved position are cancelled
+ *   - Passes are repeated until nothing changes, a solved position changes its parent
+ *   - Returns TRUE if a job was solved or cancelled
+ */
+int endgame_sweep(endgame_job_t *jobs, int n_jobs, int alpha, int beta, int *best) {
+	MPI_Request request;
+	int j, p, changed = TRUE, any = FALSE;
+
+	while (changed) {
+		changed = FALSE;
+		for (j = 0; j < n_jobs; j++) {
+			if (jobs[j].state == JOB_DONE) continue;
+			p = jobs[j].parent;
+			if (p != -1 && jobs[p].state == JOB_DONE) {
+				if (jobs[j].state == JOB_RUNNING) {
+					MPI_Isend(&jobs[j].msg[0], 1, MPI_INT, jobs[j].rank, CANCEL_JOB_TAG, MPI_COMM_WORLD, &request);
+				}
+				jobs[j].state = JOB_DONE;
+				changed = TRUE;
+				continue;
+			}
+			jobs[j].alpha = p == -1 ? alpha : -jobs[p].beta;
+			jobs[j].beta = p == -1 ? beta : -jobs[p].alpha;
+			if (jobs[j].value > jobs[j].alpha) jobs[j].alpha = jobs[j].value;
+			if (jobs[j].state == JOB_SPLIT && (jobs[j].left == 0 || jobs[j].value >= jobs[j].beta)) {
+				endgame_resolve(jobs, j, jobs[j].value, best);
+				changed = TRUE;
+			}
+		}
+		any |= changed;
+	}
+	return any;
+}
+
+/**
+ *   Rank i (i != 0) executes this code 
+ *   ----------------------------------
+ *   Called instead of iterative deepening when ENDGAME_EMPTIES or less squares are empty
+ *   - Asks master for jobs and solves them until master sends the timeout message
+ */
+void endgame_worker() {
+	int job[JOB_MSG_SIZE], result[3];
+	int value, done = FALSE;
+	uint64_t P, O;
+	MPI_Status status;
+	MPI_Request request = MPI_REQUEST_NULL;
+
+	result[0] = FALSE;
+	result[1] = -1;
+	result[2] = 0;
+	MPI_Isend(result, 3, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &request);
+
+	while (!done) {
+		MPI_Probe(0, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+		switch (status.MPI_TAG) {
+			case SEND_JOB_TAG:
+				MPI_Recv(job, JOB_MSG_SIZE, MPI_INT, 0, SEND_JOB_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				P = ((uint64_t) (unsigned int) job[1] << 32) | (unsigned int) job[2];
+				O = ((uint64_t) (unsigned int) job[3] << 32) | (unsigned int) job[4];
+				current_job = job[0];
+				job_cancelled = FALSE;
+				value = endgame_solve(P, O, job[5], job[6], poll_endgame_job);
+				current_job = -1;
+				if (timeout) {
+					done = TRUE;
+					break;
+				}
+				// Send the result and ask for the next job
+				MPI_Wait(&request, MPI_STATUS_IGNORE);
+				result[0] = !job_cancelled;
+				result[1] = job[0];
+				result[2] = value;
+				MPI_Isend(result, 3, MPI_INT, 0, REQUEST_MOVE_TAG, MPI_COMM_WORLD, &request);
+				break;
+
+			case CANCEL_JOB_TAG: // the job was already done
+				MPI_Recv(&value, 1, MPI_INT, 0, CANCEL_JOB_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				break;
+
+			case TIMEOUT_TAG:
+				MPI_Recv(&timeout, 1, MPI_INT, 0, TIMEOUT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				done = TRUE;
+				break;
+
+			default: // stray alpha from the other workers
+				MPI_Recv(&value, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				break;
+		}
+	}
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+	MPI_Barrier(MPI_COMM_WORLD);
+	drain_messages(NULL);
+}
+
+/**
+ *   Called by the solver on a worker, returns TRUE if the job should stop
+ *   because of the timeout message or because master cancelled it
+ */
+int poll_endgame_job() {
+	int flag, id;
+
+	if (check_timeout()) return TRUE;
+	MPI_Iprobe(0, CANCEL_JOB_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+	while (flag) {
+		MPI_Recv(&id, 1, MPI_INT, 0, CANCEL_JOB_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		if (id == current_job) job_cancelled = TRUE;
+		MPI_Iprobe(0, CANCEL_JOB_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE);
+	}
+	return job_cancelled;
+}
+
+/**
+ *   Called after the barrier, receives messages nobody waited for
+ *   - Returns TRUE if one of them was the timeout message
+ *   - A win the prover sent after master stopped looking is put in proven_move,
+ *     unless it is NULL
+ */
+int drain_messages(int *proven_move) {
+	int flag, buffer[JOB_MSG_SIZE], timed_out = FALSE;
+	MPI_Status status;
+
+	flag = TRUE; 
+	while (flag) {
+		MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+		if (flag) {
+			MPI_Recv(buffer, JOB_MSG_SIZE, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			if (status.MPI_TAG == TIMEOUT_TAG) timed_out = TRUE;
+			if (status.MPI_TAG == PROVEN_MOVE_TAG && proven_move != NULL) *proven_move = buffer[0];
+		}
+	}
+	return timed_out;
+}
+
+/**
+ *   Rank comm_sz-1 executes this code 
+ *   ---------------------------------
+ *   Called instead of iterative deepening when PNS_EMPTIES or less squares are
+ *   empty and there are enough ranks to spare one
+ *   - Proof-number search tries to prove a win, it is stopped at the end of
+ *     every depth to take part in the barrier and gather, then continues
+ *   - A winning move is sent to master, which stops the search and plays it
+ *   - Without a legal move there is nothing to prove, a pass is not a move to play
+ */
+void pns_worker(int my_colour) {
+	int best_move[2], proof = PNS_UNKNOWN, sq, loc = -1;
+	uint64_t P, O;
+	MPI_Status status;
+	MPI_Request request = MPI_REQUEST_NULL;
+
+	board_to_bitboards(my_colour, &P, &O);
+	if (get_moves(P, O) == 0) proof = PNS_NO_WIN;
+	while (!timeout) {
+		pns_stop = FALSE;
+		if (proof == PNS_UNKNOWN) {
+			proof = pns_prove(P, O, &sq, poll_pns);
+			if (proof == PNS_WIN) {
+				loc = 10*(sq/8 + 1) + sq%8 + 1;
+				MPI_Isend(&loc, 1, MPI_INT, 0, PROVEN_MOVE_TAG, MPI_COMM_WORLD, &request);
+			}
+		}
+		// Nothing left to prove, wait for the end of this depth
+		while (!poll_pns()) {
+			MPI_Probe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &status);
+		}
+		MPI_Barrier(MPI_COMM_WORLD);
+		if (drain_messages(NULL)) timeout = TRUE;
+		// The prover never has a searched move to report
+		best_move[0] = -1;
+		best_move[1] = -1000000;
+		MPI_Gather(best_move, 2, MPI_INT, NULL, 0, MPI_INT, 0, MPI_COMM_WORLD);
+	}
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+/**
+ *   Called by proof-number search on the prover, returns TRUE once master
+ *   ended the current depth or sent the timeout message
+ *   - Alpha values the searching workers share are received and ignored
+ */
+int poll_pns() {
+	int flag, value;
+	MPI_Status status;
+
+	if (pns_stop || timeout) return TRUE;
+	MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+	while (flag) {
+		MPI_Recv(&value, 1, MPI_INT, status.MPI_SOURCE, status.MPI_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		if (status.MPI_TAG == NO_MOVES_LEFT_TAG) pns_stop = TRUE;
+		if (status.MPI_TAG == TIMEOUT_TAG) timeout = TRUE;
+		if (pns_stop || timeout) return TRUE;
+		MPI_Iprobe(MPI_ANY_SOURCE, MPI_ANY_TAG, MPI_COMM_WORLD, &flag, &status);
+	}
+	return FALSE;
+}
+
+/**
+ *  Rank 0 executes this code: 
+ *  --------------------------
+ *  Called between iterations of iterative deepening
+ *  - The best move of the previous depth is sent out first
+ *  - Other moves are sorted by the score they got at the previous depth,
+ *    ties keep the order they already had
+ */
+void order_root_moves(int *moves, int *scores, int best) {
+	int i, j, move, score, first = 1;
+
+	// Put the best move in front
+	for (i = 1; i <= moves[0]; i++) {
+		if (moves[i] == best) {
+			for (j = i; j > 1; j--) {
+				moves[j] = moves[j-1];
+				scores[j] = scores[j-1];
+			}
+			moves[1] = best;
+			scores[1] = 1000000;
+			first = 2;
+			break;
+		}
+	}
+	// Insertion sort on the rest so that equal scores keep their order
+	for (i = first + 1; i <= moves[0]; i++) {
+		move = moves[i];
+		score = scores[i];
+		for (j = i - 1; j >= first && scores[j] < score; j--) {
+			moves[j+1] = moves[j];
+			scores[j+1] = scores[j];
+		}
+		moves[j+1] = move;
+		scores[j+1] = score;
+	}
+}
+
 void make_move(int move, int player, FILE *fp) {
 	int i;
 	board[move] = player;
@@ -674,8 +1782,8 @@ void copy_board(int *original, int *copy) {
 int eval_parity() {
 	int max_val, min_val;
 
-	max_val = count(max_colour, board);
-	min_val = count(opponent(max_colour, NULL), board);
+	max_val = path.discs[0];
+	min_val = path.discs[1];
 	
 	if (min_val == 0) return 10000;
 	return 100 * (max_val - min_val) / (max_val + min_val);
@@ -684,15 +1792,18 @@ int eval_parity() {
 /**
  *   Evaluation on the amount of available moves
  *   --------------------------------------------
+ *   - The moves of the side to move are already in path, only the other side's are generated
  */
-int eval_mobility() {
+int eval_mobility(int current_colour) {
 	int max_val, min_val;
-	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
 
-	legal_moves(max_colour, moves, NULL);
-	max_val = moves[0];
-	legal_moves(opponent(max_colour, NULL), moves, NULL);
-	min_val = moves[0];
+	if (current_colour == max_colour) {
+		max_val = bit_count(path.moves);
+		min_val = bit_count(get_moves(path.O, path.P));
+	} else {
+		max_val = bit_count(get_moves(path.P, path.O));
+		min_val = bit_count(path.moves);
+	}
 
 	if (max_val + min_val == 0) return 0;
 	else return 100 * (max_val - min_val) / (max_val + min_val);
@@ -703,93 +1814,46 @@ int eval_mobility() {
  *   ----------------------------------
  */
 int eval_corners() {
-	int max_val = 0, min_val = 0;
-
-	if (board[11] == max_colour) max_val++;
-	if (board[18] == max_colour) max_val++;
-	if (board[81] == max_colour) max_val++;
-	if (board[88] == max_colour) max_val++;
-	if (board[11] == opponent(max_colour, NULL)) min_val++;
-	if (board[18] == opponent(max_colour, NULL)) min_val++;
-	if (board[81] == opponent(max_colour, NULL)) min_val++;
-	if (board[88] == opponent(max_colour, NULL)) min_val++;
+	int max_val, min_val;
+
+	max_val = bit_count(path.P & 0x8100000000000081ULL);
+	min_val = bit_count(path.O & 0x8100000000000081ULL);
 	
 	if (max_val + min_val == 0) return 0;
 	else return 100 * (max_val - min_val) / (max_val + min_val);
 }
 
 /**
- *   Evaluation on the stability of disks
+ *   Evaluation on frontier disks, disks next to an empty square
+ *   ------------------------------------------------------------
+ *   - Fewer is better, they give the other side moves
+ */
+int eval_frontier() {
+	int max_val, min_val;
+
+	max_val = path.frontier[0];
+	min_val = path.frontier[1];
+
+	if (max_val + min_val == 0) return 0;
+	else return 100 * (min_val - max_val) / (max_val + min_val);
+}
+
+/**
+ *   Evaluation on the stability of disks
  *   -------------------------------------
- *   - The board is traversed in a spiral so that if a loop is found
- *     with all disks unstable, we can stop searching as all other disks
- *     will be unstable 
+ *   - Counts disks that can never flip: edge disks from a lookup table,
+ *     disks on full lines and disks held by those, see get_stable in bitboard.c
+ *   - Edge stability is kept up to date along the search path, a leaf only
+ *     grows the inner stable disks from it
  */
 int eval_stability() {
-	int value, i, loc, flag;
-	int unstable_loop = TRUE;
-	int max_val = 0, min_val = 0;
-	int *stability_board = (int *) calloc(BOARDSIZE, sizeof(int));
+	uint64_t stable;
+	int max_val, min_val;
 
-	for (i = 0; i < 64; i++) {
-		// Check for timeout message
-		MPI_Iprobe(0, TIMEOUT_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE); 
-		if (flag) {
-			MPI_Recv(&timeout, 1, MPI_INT, 0, TIMEOUT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE); 
-			free(stability_board);
-			return -100000;
-		}
-		
-		loc = spiral[i]; // Iterate in a spiral pattern
-
-		if (board[loc] == EMPTY) continue;
-
-		value = 0;
-
-		// is horizontal border
-		if (loc % 10 == 1 || loc % 10 == 8) value += H_BORDER;
-		else if ((board[loc] == board[loc-1] && IS_H_BORDER(stability_board[loc-1])) ||
-				 (board[loc] == board[loc+1] && IS_H_BORDER(stability_board[loc+1]))) {
-			value += H_BORDER;
-		}
-		// is vertical border
-		if (loc / 10 == 1 || loc / 10 == 8) value += V_BORDER;
-		else if	((board[loc] == board[loc-10] && IS_V_BORDER(stability_board[loc-10])) ||
-				 (board[loc] == board[loc+10] && IS_V_BORDER(stability_board[loc+10]))) {
-			value += V_BORDER;
-		}
-		// is up down diagonal border
-		if (loc % 10 == 1 || loc % 10 == 8 || loc / 10 == 1 || loc / 10 == 8) value += UDD_BORDER;
-		else if	((board[loc] == board[loc-11] && IS_UDD_BORDER(stability_board[loc-11])) ||
-				 (board[loc] == board[loc+11] && IS_UDD_BORDER(stability_board[loc+11]))) {
-			value += UDD_BORDER;
-		}
-		// is down up diagonal border
-		if (loc % 10 == 1 || loc % 10 == 8 || loc / 10 == 1 || loc / 10 == 8) value += DUD_BORDER;
-		else if	((board[loc] == board[loc-9] && IS_DUD_BORDER(stability_board[loc-9])) ||
-				(board[loc] == board[loc+9] && IS_DUD_BORDER(stability_board[loc+9]))) {
-			value += DUD_BORDER;
-		}
-		// add evaluation
-		if (board[loc] == max_colour) {
-			if (IS_STABLE(value)) max_val++;
-			else if (IS_UNSTABLE(value)) max_val--;
-		} else {
-			if (IS_STABLE(value)) min_val++;
-			else if (IS_UNSTABLE(value)) min_val--;
-		}	
-		// update loc stability
-		stability_board[loc] = value; 
+	stable = grow_stable(path.P, path.O, path.stable);
+	max_val = bit_count(stable & path.P);
+	min_val = bit_count(stable & path.O);
 
-		// Check if loop is unstable
-		if (IS_H_BORDER(value) || IS_V_BORDER(value) || IS_UDD_BORDER(value) || IS_DUD_BORDER(value)) {
-			unstable_loop = FALSE;
-		}
-		// if a loop contains no stable/semi-stable disks, there won't be any inside this loop
-		if (IS_LOOP_COMPLETED(loc) && unstable_loop) break;
-		else unstable_loop = TRUE;
-	}
-	free(stability_board);
 	if (max_val + min_val == 0) return 0;
 	return 100 * (max_val - min_val) / (max_val + min_val);
 }
@@ -797,30 +1861,124 @@ int eval_stability() {
 /**
  *   Weighting of evaluation functions
  *   ----------------------------------
- *   Called to get evalution for a position.
- *   - Without stability, depth can be pushed to about 9
- */
-int eval_position() {
-	int parity = 0, mobility = 0, corners = 0, stability = 0;
-	int moves = 0;
-
-	moves = count(max_colour, board) + count(opponent(max_colour, NULL), board);
-
-	if (moves < 14) {
-		parity = 5*eval_parity();
-		corners = 30*eval_corners();
-		mobility = 10*eval_mobility();
-		stability = 20*eval_stability();
-	}	else if (moves < 64 - STARTING_MAX_DEPTH) {
-		parity = 25*eval_parity();
-		corners = 30*eval_corners();
-		mobility = eval_mobility();
-		stability = 25*eval_stability();
-	} else {
-		parity = eval_parity();
+ *   Called to get evalution for a position, alpha and beta are the window of the caller.
+ *   - Every term reads path, which make and unmake keep up to date, none scans the board
+ *   - Values and lazy bounds are cached by position and side to move, a repeated leaf
+ *     costs one read when the cached value answers its window
+ *   - Terms are added cheapest first: parity, corners and frontier, then stability, then mobility.
+ *     When the terms left cannot bring the score into the window, a bound is returned
+ *     without them (fail-soft, the bound is on the side of the window the score is on)
+ *   - A term is within -100..100; stability is counted at full size, mobility at
+ *     lazy_mobility percent, since |eval_mobility| stays below 60 in 99% of positions
+ *   - Stability comes from bitboards and edge tables, it costs about as much as leaving it out
+ *   - With a network file, the network in nnue.c replaces all of this, its
+ *     first layer is kept up to date along the search path
+ *   - Otherwise with a weights file, the pattern evaluation in pattern.c does;
+ *     it was trained for the side to move and is negated when that is not max_colour
+ *   - Weights change gradually with the number of disks, see build_eval_table;
+ *     weights and phase limits are search parameters, see params
+ */
+int eval_position(int current_colour, int alpha, int beta) {
+	const int *w;
+	int score, margin;
+	unsigned long long key = path.key ^ zobrist_side[current_colour];
+	eval_entry_t *entry = &eval_cache[key & ((1 << EVAL_CACHE_BITS) - 1)];
+
+	eval_probes++;
+	if (entry->key == key && (entry->flag == TT_EXACT ||
+		(entry->flag == TT_UPPER && entry->value <= alpha) ||
+		(entry->flag == TT_LOWER && entry->value >= beta))) {
+		eval_hits++;
+		return entry->value;
 	}
-	
-	return parity + corners + mobility + stability;
+
+	if (nnue_loaded()) return store_eval(entry, key, nnue_eval(&nnue_stack[path.ply], current_colour != max_colour), TT_EXACT);
+	if (pattern_loaded()) return store_eval(entry, key, current_colour == max_colour ?
+		pattern_eval(path.P, path.O) : -pattern_eval(path.O, path.P), TT_EXACT);
+
+	w = eval_table[path.discs[0] + path.discs[1]];
+
+	score = w[0]*eval_parity() + w[1]*eval_corners() + w[4]*eval_frontier();
+	margin = 100*w[3] + lazy_mobility*w[2];
+	if (score + margin <= alpha) return store_eval(entry, key, score + margin, TT_UPPER);
+	if (score - margin >= beta) return store_eval(entry, key, score - margin, TT_LOWER);
+
+	score += w[3]*eval_stability();
+	margin = lazy_mobility*w[2];
+	if (score + margin <= alpha) return store_eval(entry, key, score + margin, TT_UPPER);
+	if (score - margin >= beta) return store_eval(entry, key, score - margin, TT_LOWER);
+
+	return store_eval(entry, key, score + w[2]*eval_mobility(current_colour), TT_EXACT);
+}
+
+/**
+ *   Value of a node one move from the leaves, with the network or the patterns
+ *   ----------------------------------
+ *   Called by minimax at depth 1 instead of searching every child.
+ *   - Children are only made on bitboards, EVAL_BATCH at a time; those not in
+ *     the eval cache are scored by one call of the batched evaluation
+ *   - Alpha beta is applied between batches, a cutoff in the first batch
+ *     skips the rest; values and best move are those minimax would give
+ */
+int eval_children(unsigned long long key, int *moves, int current_colour, int alpha, int beta, int *best) {
+	static nnue_acc_t acc[EVAL_BATCH];
+	uint64_t P[EVAL_BATCH], O[EVAL_BATCH], flips;
+	unsigned long long keys[EVAL_BATCH];
+	eval_entry_t *entries[EVAL_BATCH];
+	int values[EVAL_BATCH], scores[EVAL_BATCH], misses[EVAL_BATCH];
+	int i, b, n, n_misses, sq, move, maximise = current_colour == max_colour;
+	int value = maximise ? -1000000 : 1000000;
+
+	for (i = 1; i <= moves[0]; i += n) {
+		n = moves[0] - i + 1 < EVAL_BATCH ? moves[0] - i + 1 : EVAL_BATCH;
+		n_misses = 0;
+		for (b = 0; b < n; b++) {
+			move = moves[i + b];
+			keys[b] = child_hash(key, move, current_colour);
+			entries[b] = &eval_cache[keys[b] & ((1 << EVAL_CACHE_BITS) - 1)];
+			eval_probes++;
+			if (entries[b]->key == keys[b] && entries[b]->flag == TT_EXACT) {
+				eval_hits++;
+				values[b] = entries[b]->value;
+				continue;
+			}
+			sq = 8 * (move / 10 - 1) + move % 10 - 1;
+			if (maximise) {
+				flips = get_flips(sq, path.P, path.O);
+				P[n_misses] = path.P | flips | BIT(sq);
+				O[n_misses] = path.O & ~flips;
+			} else {
+				flips = get_flips(sq, path.O, path.P);
+				O[n_misses] = path.O | flips | BIT(sq);
+				P[n_misses] = path.P & ~flips;
+			}
+			if (nnue_loaded()) nnue_move(&nnue_stack[path.ply], &acc[n_misses], sq, flips, !maximise);
+			misses[n_misses++] = b;
+		}
+		// The children have the other side to move, the patterns score them from its side
+		if (nnue_loaded()) {
+			nnue_eval_batch(acc, n_misses, maximise, scores);
+		} else if (maximise) {
+			pattern_eval_batch(O, P, n_misses, scores);
+			for (b = 0; b < n_misses; b++) scores[b] = -scores[b];
+		} else {
+			pattern_eval_batch(P, O, n_misses, scores);
+		}
+		for (b = 0; b < n_misses; b++) {
+			values[misses[b]] = store_eval(entries[misses[b]], keys[misses[b]], scores[b], TT_EXACT);
+		}
+
+		for (b = 0; b < n; b++) {
+			if (maximise ? values[b] > value : values[b] < value) {
+				value = values[b];
+				*best = moves[i + b];
+			}
+			if (maximise && value > alpha) alpha = value;
+			if (!maximise && value < beta) beta = value;
+			if (beta <= alpha) return value;
+		}
+	}
+	return value;
 }
 
 /**
@@ -828,43 +1986,110 @@ int eval_position() {
  *   ----------------------------------
  *   Called to get evalution for a move.
  *   - Minimax with alpha beta pruning
+ *   - One move from the leaves, the network and the patterns go through eval_children
  */
 int minimax(int current_colour, int depth, int alpha, int beta) {
 	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
 	int *board_copy = (int *) calloc(BOARDSIZE, sizeof(int));
 	int eval, max_eval, min_eval;
-	int i;
-	int flag;
-
-	// Check for timeout message
-	MPI_Iprobe(0, TIMEOUT_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE); 
-	if (flag) {
-		MPI_Recv(&timeout, 1, MPI_INT, 0, TIMEOUT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE); 
-	}
-	if (timeout) {
+	int i, best = 0;
+	int alpha_start = alpha, beta_start = beta;
+	unsigned long long key;
+	tt_entry_t *entry;
+	path_t path_copy;
+
+	// Check for timeout message, the flag every node and MPI only every POLL_NODES nodes
+	if (timeout || (++nodes % POLL_NODES == 0 && check_timeout())) {
 		free(moves);
 		free(board_copy);
 		return -100000;
 	}
 
-	legal_moves(current_colour, moves, NULL);
+	path_moves(current_colour, moves);
 	if (depth == 0 || moves[0] == 0) {
 		free(moves);
 		free(board_copy);
-		return eval_position();
+		return eval_position(current_colour, alpha, beta);
+	}
+
+	// Transposition table
+	key = path.key ^ zobrist_side[current_colour];
+	entry = probe_tt(key);
+	if (entry != NULL && entry->depth >= depth) {
+		if (entry->flag == TT_EXACT ||
+			(entry->flag == TT_LOWER && entry->value >= beta) ||
+			(entry->flag == TT_UPPER && entry->value <= alpha)) {
+			free(moves);
+			free(board_copy);
+			return entry->value;
+		}
+	}
+
+	// Only nodes that are searched are sorted
+	if (depth >= HISTORY_MIN_DEPTH) order_by_history(current_colour, moves);
+	if (entry != NULL) {
+		// Search the stored best move first, the others keep their order
+		for (i = 2; i <= moves[0]; i++) {
+			if (moves[i] == entry->move) {
+				memmove(&moves[2], &moves[1], (i - 1) * sizeof(int));
+				moves[1] = entry->move;
+				break;
+			}
+		}
+	}
+
+	// A child in the table may already refute this node
+	if (depth >= ETC_MIN_DEPTH) {
+		eval = etc_cutoff(key, moves, current_colour, depth, alpha, beta);
+		if (eval != NO_CUT) {
+			free(moves);
+			free(board_copy);
+			return eval;
+		}
+	}
+
+	// Try to prune with a shallow search
+	if (probcut_enabled && !in_probcut && depth >= PROBCUT_MIN_DEPTH) {
+		eval = probcut(current_colour, depth, alpha, beta);
+		if (eval != NO_CUT) {
+			free(moves);
+			free(board_copy);
+			return eval;
+		}
+	}
+
+	// One move from the leaves, the network and the patterns score all children together
+	if (depth == 1 && (nnue_loaded() || pattern_loaded())) {
+		eval = eval_children(key, moves, current_colour, alpha, beta, &best);
+		if (!timeout) store_tt(key, depth, eval, eval <= alpha_start ? TT_UPPER : (eval >= beta_start ? TT_LOWER : TT_EXACT), best);
+		free(moves);
+		free(board_copy);
+		return eval;
 	}
 
 	copy_board(board, board_copy);
+	path_copy = path;
 
 	if (current_colour == max_colour) {
 		max_eval = -1000000;
 		for (i = 1; i <= moves[0]; i++) {
 			make_move(moves[i], current_colour, NULL);
+			advance_path(moves[i], current_colour);
 			eval = minimax(opponent(current_colour, NULL), depth-1, alpha, beta);
 			copy_board(board_copy, board);
-			if (eval > max_eval) max_eval = eval;
+			path = path_copy;
+			if (eval > max_eval) {
+				max_eval = eval;
+				best = moves[i];
+			}
 			if (max_eval > alpha) alpha = max_eval;
-			if (beta <= alpha) break;
+			if (beta <= alpha) {
+				if (!timeout) history[current_colour][best] += depth * depth;
+				break;
+			}
+		}
+		if (!timeout) {
+			store_tt(key, depth, max_eval, max_eval <= alpha_start ? TT_UPPER : (max_eval >= beta_start ? TT_LOWER : TT_EXACT), best);
 		}
 		free(moves);
 		free(board_copy);
@@ -873,14 +2098,883 @@ int minimax(int current_colour, int depth, int alpha, int beta) {
 		min_eval = 1000000;
 		for (i = 1; i <= moves[0]; i++) {
 			make_move(moves[i], current_colour, NULL);
+			advance_path(moves[i], current_colour);
 			eval = minimax(opponent(current_colour, NULL), depth-1, alpha, beta);
 			copy_board(board_copy, board);
-			if (eval < min_eval) min_eval = eval;
+			path = path_copy;
+			if (eval < min_eval) {
+				min_eval = eval;
+				best = moves[i];
+			}
 			if (min_eval < beta) beta = min_eval;
-			if (beta <= alpha) break;
+			if (beta <= alpha) {
+				if (!timeout) history[current_colour][best] += depth * depth;
+				break;
+			}
+		}
+		if (!timeout) {
+			store_tt(key, depth, min_eval, min_eval >= beta_start ? TT_LOWER : (min_eval <= alpha_start ? TT_UPPER : TT_EXACT), best);
 		}
 		free(moves);
 		free(board_copy);
 		return min_eval;
 	}
-}
\ No newline at end of file
+}
+
+/**
+ *   Sets the bitboards and stable disks of the search path from the board,
+ *   called at the root of every search
+ */
+void start_path() {
+	board_to_bitboards(max_colour, &path.P, &path.O);
+	path.stable = get_stable(path.P, path.O);
+	path.moves = 0;
+	path.discs[0] = bit_count(path.P);
+	path.discs[1] = bit_count(path.O);
+	path.frontier[0] = bit_count(get_frontier(path.P, path.O));
+	path.frontier[1] = bit_count(get_frontier(path.O, path.P));
+	path.key = hash_board(BLACK) ^ zobrist_side[BLACK];
+	path.ply = 0;
+	if (nnue_loaded()) nnue_refresh(&nnue_stack[0], path.P, path.O);
+}
+
+/**
+ *   Follows a move along the search path
+ *   - Flips come from the bitboards
+ *   - Corners and edges are updated right away, only for the edges the move changed
+ *   - Disk and frontier counts follow the bitboards, the Zobrist key the placed and flipped disks
+ *   - The network accumulators of the child go to the next slot of nnue_stack,
+ *     so restoring path also takes the move back
+ */
+void advance_path(int move, int player) {
+	int sq = 8 * (move / 10 - 1) + move % 10 - 1, f;
+	uint64_t flips, rest;
+
+	if (player == max_colour) {
+		flips = get_flips(sq, path.P, path.O);
+		path.P |= flips | BIT(sq);
+		path.O &= ~flips;
+		path.discs[0] += bit_count(flips) + 1;
+		path.discs[1] -= bit_count(flips);
+	} else {
+		flips = get_flips(sq, path.O, path.P);
+		path.O |= flips | BIT(sq);
+		path.P &= ~flips;
+		path.discs[1] += bit_count(flips) + 1;
+		path.discs[0] -= bit_count(flips);
+	}
+	path.stable = edge_stable_after(path.P, path.O, path.stable, flips | BIT(sq));
+	path.frontier[0] = bit_count(get_frontier(path.P, path.O));
+	path.frontier[1] = bit_count(get_frontier(path.O, path.P));
+	path.key ^= zobrist[move][player];
+	for (rest = flips; rest; rest &= rest - 1) {
+		f = __builtin_ctzll(rest);
+		path.key ^= zobrist[10 * (f / 8 + 1) + f % 8 + 1][BLACK] ^ zobrist[10 * (f / 8 + 1) + f % 8 + 1][WHITE];
+	}
+	if (nnue_loaded()) {
+		nnue_move(&nnue_stack[path.ply], &nnue_stack[path.ply + 1], sq, flips, player != max_colour);
+		path.ply++;
+	}
+}
+
+/**
+ *   Moves of current_colour in the position of path, as a list of board
+ *   locations in the order legal_moves gives them
+ *   - The mask stays in path for eval_mobility
+ */
+void path_moves(int current_colour, int *moves) {
+	uint64_t mask;
+	int sq;
+
+	mask = current_colour == max_colour ? get_moves(path.P, path.O) : get_moves(path.O, path.P);
+	path.moves = mask;
+	moves[0] = 0;
+	while (mask) {
+		sq = __builtin_ctzll(mask);
+		mask &= mask - 1;
+		moves[++moves[0]] = 10 * (sq / 8 + 1) + sq % 8 + 1;
+	}
+}
+
+/**
+ *   Called during search, returns TRUE if master sent the timeout message,
+ *   the deadline of a self-play move has passed or, in predict_reply, the
+ *   referee sent a command
+ *   - minimax only calls it every POLL_NODES nodes, probing for messages
+ *     at every node was a large part of the time of the leaves
+ */
+int check_timeout() {
+	int flag;
+
+	if (deadline != 0 && MPI_Wtime() > deadline) timeout = TRUE;
+	if (predicting && comms_poll()) timeout = TRUE;
+
+	MPI_Iprobe(0, TIMEOUT_TAG, MPI_COMM_WORLD, &flag, MPI_STATUS_IGNORE); 
+	if (flag) {
+		MPI_Recv(&timeout, 1, MPI_INT, 0, TIMEOUT_TAG, MPI_COMM_WORLD, MPI_STATUS_IGNORE); 
+	}
+	return timeout;
+}
+
+int count_empties() {
+	return 64 - count(BLACK, board) - count(WHITE, board);
+}
+
+void board_to_bitboards(int current_colour, uint64_t *P, uint64_t *O) {
+	int i, loc;
+
+	*P = 0;
+	*O = 0;
+	for (i = 0; i < 64; i++) {
+		loc = 10 * (i / 8 + 1) + i % 8 + 1;
+		if (board[loc] == current_colour) *P |= BIT(i);
+		else if (board[loc] != EMPTY) *O |= BIT(i);
+	}
+}
+
+/**
+ *   Transposition table
+ *   ----------------------------------
+ *   - One table per process, indexed by the Zobrist key of the position
+ *   - Values are from the point of view of max_colour, which stays the same
+ *     for a whole game, so the workers keep the table from move to move
+ *   - Entries are replaced when the new search is at least as deep, or when
+ *     they were stored by an earlier search
+ */
+void initialise_tt() {
+	unsigned long long seed = 0x9E3779B97F4A7C15ULL;
+	int i, j;
+
+	// Same keys on every process, xorshift generator
+	for (i = 0; i < 100; i++) {
+		for (j = 0; j < 3; j++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 7;
+			seed ^= seed << 17;
+			zobrist[i][j] = (j == EMPTY) ? 0 : seed;
+		}
+	}
+	for (j = 0; j < 3; j++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		zobrist_side[j] = seed;
+	}
+	tt = (tt_entry_t *) calloc(1 << TT_BITS, sizeof(tt_entry_t));
+	eval_cache = (eval_entry_t *) calloc(1 << EVAL_CACHE_BITS, sizeof(eval_entry_t));
+}
+
+/**
+ *   Empties the transposition table, the evaluation cache and the history,
+ *   for searches where max_colour changes (self-play, calibration)
+ */
+void clear_tt() {
+	memset(tt, 0, (1 << TT_BITS) * sizeof(tt_entry_t));
+	memset(eval_cache, 0, (1 << EVAL_CACHE_BITS) * sizeof(eval_entry_t));
+	memset(history, 0, sizeof(history));
+	eval_probes = 0;
+	eval_hits = 0;
+}
+
+/**
+ *   Starts the next search of a game, where max_colour stays the same
+ *   and every table stays valid
+ *   - Entries of earlier searches are replaced first, see store_tt
+ *   - The history is halved, so the cutoffs of this search soon count most
+ */
+void age_tt() {
+	int c, loc;
+
+	tt_age++;
+	for (c = 0; c < 3; c++) {
+		for (loc = 0; loc < 100; loc++) history[c][loc] /= 2;
+	}
+	eval_probes = 0;
+	eval_hits = 0;
+}
+
+/**
+ *   Sorts moves by their history for current_colour, most cutoffs first
+ */
+void order_by_history(int current_colour, int *moves) {
+	int i, j, move;
+
+	for (i = 2; i <= moves[0]; i++) {
+		move = moves[i];
+		for (j = i; j > 1 && history[current_colour][moves[j-1]] < history[current_colour][move]; j--) moves[j] = moves[j-1];
+		moves[j] = move;
+	}
+}
+
+/**
+ *   Keeps an evaluation in the cache, returns it
+ *   - Direct mapped, a new position always replaces the old one
+ *   - Every process has its own cache and searches with one thread, so no locking
+ */
+int store_eval(eval_entry_t *entry, unsigned long long key, int value, int flag) {
+	entry->key = key;
+	entry->value = value;
+	entry->flag = flag;
+	return value;
+}
+
+/**
+ *   Adds up the evaluation cache counters of all processes since the last
+ *   clear_tt, rank 0 writes the hit rate to fp
+ */
+void report_eval_cache(FILE *fp) {
+	unsigned long long counts[2] = {eval_probes, eval_hits}, totals[2];
+	int rank;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Reduce(counts, totals, 2, MPI_UNSIGNED_LONG_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank == 0 && fp != NULL && totals[0] > 0) {
+		fprintf(fp, "Eval cache: %llu of %llu hits (%.1f%%)\n", totals[1], totals[0], 100.0 * totals[1] / totals[0]);
+		fflush(fp);
+	}
+}
+
+unsigned long long hash_board(int current_colour) {
+	unsigned long long key = zobrist_side[current_colour];
+	int loc;
+
+	for (loc = 11; loc <= 88; loc++) key ^= zobrist[loc][board[loc]];
+	return key;
+}
+
+/**
+ *   Key of the position after player plays move, without changing the board
+ */
+unsigned long long child_hash(unsigned long long key, int move, int player) {
+	int i, c, dir, bracketer;
+	int other = opponent(player, NULL);
+
+	key ^= zobrist_side[player] ^ zobrist_side[other] ^ zobrist[move][player];
+	for (i = 0; i <= 7; i++) {
+		dir = ALLDIRECTIONS[i];
+		bracketer = would_flip(move, dir, player, NULL);
+		if (bracketer) {
+			for (c = move + dir; c != bracketer; c += dir) key ^= zobrist[c][other] ^ zobrist[c][player];
+		}
+	}
+	return key;
+}
+
+tt_entry_t *probe_tt(unsigned long long key) {
+	tt_entry_t *entry = &tt[key & ((1 << TT_BITS) - 1)];
+	if (entry->key == key) return entry;
+	return NULL;
+}
+
+void store_tt(unsigned long long key, int depth, int value, int flag, int move) {
+	tt_entry_t *entry = &tt[key & ((1 << TT_BITS) - 1)];
+	if (entry->key != key && entry->depth > depth && entry->age == tt_age) return;
+	entry->age = tt_age;
+	entry->key = key;
+	entry->value = value;
+	entry->depth = depth;
+	entry->flag = flag;
+	entry->move = move;
+}
+
+/**
+ *   Enhanced Transposition Cutoffs
+ *   ----------------------------------
+ *   Called before the move loop of minimax.
+ *   - All child keys are made first and their slots prefetched, then probed
+ *   - A max node is cut if a child has a lower bound >= beta,
+ *     a min node if a child has an upper bound <= alpha
+ */
+int etc_cutoff(unsigned long long key, int *moves, int current_colour, int depth, int alpha, int beta) {
+	unsigned long long keys[LEGALMOVSBUFSIZE];
+	tt_entry_t *entry;
+	int i;
+
+	for (i = 1; i <= moves[0]; i++) {
+		keys[i] = child_hash(key, moves[i], current_colour);
+		__builtin_prefetch(&tt[keys[i] & ((1 << TT_BITS) - 1)]);
+	}
+	for (i = 1; i <= moves[0]; i++) {
+		entry = probe_tt(keys[i]);
+		if (entry == NULL || entry->depth < depth - 1) continue;
+		if (current_colour == max_colour) {
+			if (entry->flag != TT_UPPER && entry->value >= beta) return entry->value;
+		} else {
+			if (entry->flag != TT_LOWER && entry->value <= alpha) return entry->value;
+		}
+	}
+	return NO_CUT;
+}
+
+/**
+ *   Multi-ProbCut
+ *   ----------------------------------
+ *   Called before the move loop of minimax.
+ *   - A shallow search predicts the deep result through deep = a * shallow + b
+ *   - If the prediction is outside the window by PROBCUT_CONFIDENCE * sigma,
+ *     the node is cut
+ *   - Parameters depend on depth and game phase, see run_calibrate
+ */
+int probcut(int current_colour, int depth, int alpha, int beta) {
+	probcut_t *pc;
+	double b;
+	int bound, eval;
+	int result = NO_CUT;
+
+	pc = &probcut_table[probcut_phase()][depth];
+	if (pc->shallow == 0 || pc->a <= 0) return NO_CUT;
+
+	// Parameters are fitted for the side to move, so the offset flips for the minimising side
+	b = (current_colour == max_colour) ? pc->b : -pc->b;
+
+	in_probcut = TRUE;
+	if (beta < 1000000) {
+		bound = (int) ceil((beta + PROBCUT_CONFIDENCE * pc->sigma - b) / pc->a);
+		eval = minimax(current_colour, pc->shallow, bound - 1, bound);
+		if (!timeout && eval >= bound) result = beta;
+	}
+	if (result == NO_CUT && alpha > -1000000 && !timeout) {
+		bound = (int) floor((alpha - PROBCUT_CONFIDENCE * pc->sigma - b) / pc->a);
+		eval = minimax(current_colour, pc->shallow, bound, bound + 1);
+		if (!timeout && eval <= bound) result = alpha;
+	}
+	in_probcut = FALSE;
+
+	return result;
+}
+
+int probcut_phase() {
+	return (count(BLACK, board) + count(WHITE, board) - 4) * PROBCUT_PHASES / 61;
+}
+
+/**
+ *   Depth of the shallow search used to predict a search of depth
+ *   - Roughly half the depth, with the same parity
+ */
+int probcut_shallow_depth(int depth) {
+	return (depth % 2) + 2 * (depth / 4);
+}
+
+/**
+ *   Reads the ProbCut parameters written by run_calibrate
+ *   ------------------------------------------------------
+ *   Each line is: phase depth shallow a b sigma
+ *   - If the file does not exist, ProbCut stays disabled
+ */
+void load_probcut(char *filename) {
+	char line[256];
+	int phase, depth, shallow;
+	double a, b, sigma;
+	FILE *fp = fopen(filename, "r");
+
+	memset(probcut_table, 0, sizeof(probcut_table));
+	probcut_enabled = FALSE;
+	if (fp == NULL) return;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%d %d %d %lf %lf %lf", &phase, &depth, &shallow, &a, &b, &sigma) != 6) continue;
+		if (phase < 0 || phase >= PROBCUT_PHASES || depth < PROBCUT_MIN_DEPTH || depth > MAX_DEPTH) continue;
+		if (shallow <= 0 || shallow >= depth) continue;
+		probcut_table[phase][depth].shallow = shallow;
+		probcut_table[phase][depth].a = a;
+		probcut_table[phase][depth].b = b;
+		probcut_table[phase][depth].sigma = sigma;
+		probcut_enabled = TRUE;
+	}
+	fclose(fp);
+}
+
+/**
+ *   Reads a position from a line of the corpus
+ *   -------------------------------------------
+ *   A line is 64 squares row by row, using '.', 'b' and 'w',
+ *   followed by the side to move ('b' or 'w')
+ *   - Returns FALSE if the line is not a position
+ */
+int read_position(char *line, int *colour) {
+	int i, j, loc;
+	char side;
+
+	for (i = 0; i < 64; i++) {
+		loc = 10 * (i / 8 + 1) + i % 8 + 1;
+		for (j = 0; j < 3 && piecenames[j] != line[i]; j++);
+		if (j == 3) return FALSE;
+		board[loc] = j;
+	}
+	if (sscanf(line + 64, " %c", &side) != 1) return FALSE;
+	if (side == piecenames[BLACK]) *colour = BLACK;
+	else if (side == piecenames[WHITE]) *colour = WHITE;
+	else return FALSE;
+	return TRUE;
+}
+
+/**
+ *   All ranks execute this code
+ *   ----------------------------------
+ *   my_player calibrate <corpus> <outfile> [max depth]
+ *   - Runs a full-width search at every depth on each position of the corpus,
+ *     positions are divided between the ranks
+ *   - Fits deep = a * shallow + b for every depth and phase with least squares
+ *   - Rank 0 writes the parameters that load_probcut reads
+ */
+void run_calibrate(int argc, char *argv[]) {
+	// n, sum x, sum y, sum xx, sum xy, sum yy
+	double sums[PROBCUT_PHASES][MAX_DEPTH+1][6];
+	double totals[PROBCUT_PHASES][MAX_DEPTH+1][6];
+	double *t, n, a, b, sse;
+	int values[MAX_DEPTH+1];
+	int rank, comm_sz, max_depth = 8;
+	int colour, phase, depth, shallow, index = 0;
+	char line[256];
+	FILE *corpus, *out;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	if (argc < 4) {
+		if (rank == 0) fprintf(stderr, "Arguments: calibrate <corpus> <outfile> [max depth]\n");
+		return;
+	}
+	if (argc >= 5) max_depth = atoi(argv[4]);
+	if (max_depth > MAX_DEPTH) max_depth = MAX_DEPTH;
+
+	corpus = fopen(argv[2], "r");
+	if (corpus == NULL) {
+		if (rank == 0) fprintf(stderr, "File %s could not be opened\n", argv[2]);
+		return;
+	}
+
+	// Searches must be full width
+	probcut_enabled = FALSE;
+	timeout = FALSE;
+	memset(sums, 0, sizeof(sums));
+
+	while (fgets(line, sizeof(line), corpus) != NULL) {
+		if (!read_position(line, &colour)) continue;
+		if (index++ % comm_sz != rank) continue;
+
+		max_colour = colour;
+		clear_tt();
+		phase = probcut_phase();
+		start_path();
+		for (depth = 1; depth <= max_depth; depth++) {
+			values[depth] = minimax(colour, depth, -1000000, 1000000);
+		}
+		for (depth = PROBCUT_MIN_DEPTH; depth <= max_depth; depth++) {
+			t = sums[phase][depth];
+			shallow = probcut_shallow_depth(depth);
+			t[0] += 1;
+			t[1] += values[shallow];
+			t[2] += values[depth];
+			t[3] += (double) values[shallow] * values[shallow];
+			t[4] += (double) values[shallow] * values[depth];
+			t[5] += (double) values[depth] * values[depth];
+		}
+	}
+	fclose(corpus);
+
+	MPI_Reduce(sums, totals, PROBCUT_PHASES * (MAX_DEPTH+1) * 6, MPI_DOUBLE, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank != 0) return;
+
+	out = fopen(argv[3], "w");
+	if (out == NULL) {
+		fprintf(stderr, "File %s could not be opened\n", argv[3]);
+		return;
+	}
+	fprintf(out, "# phase depth shallow a b sigma\n");
+	for (phase = 0; phase < PROBCUT_PHASES; phase++) {
+		for (depth = PROBCUT_MIN_DEPTH; depth <= max_depth; depth++) {
+			t = totals[phase][depth];
+			n = t[0];
+			// too few positions or no spread to fit a line
+			if (n < 10 || n * t[3] - t[1] * t[1] <= 0) continue;
+			a = (n * t[4] - t[1] * t[2]) / (n * t[3] - t[1] * t[1]);
+			b = (t[2] - a * t[1]) / n;
+			sse = t[5] - 2*a*t[4] - 2*b*t[2] + a*a*t[3] + 2*a*b*t[1] + n*b*b;
+			if (sse < 0) sse = 0;
+			fprintf(out, "%d %d %d %f %f %f\n", phase, depth, probcut_shallow_depth(depth), a, b, sqrt(sse / n));
+		}
+	}
+	fclose(out);
+	printf("Calibrated ProbCut on %d positions\n", index);
+}
+
+/**
+ *   Reads search parameters, one per line: name value
+ *   --------------------------------------------------
+ *   - Parameters missing from the file keep their defaults
+ *   - Returns FALSE if the file does not exist
+ */
+int load_params(char *filename) {
+	char line[256], name[64];
+	int i, value;
+	FILE *fp = fopen(filename, "r");
+
+	if (fp == NULL) return FALSE;
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (line[0] == '#') continue;
+		if (sscanf(line, "%63s %d", name, &value) != 2) continue;
+		for (i = 0; i < n_params && strcmp(params[i].name, name) != 0; i++);
+		if (i == n_params) {
+			fprintf(stderr, "Unknown parameter %s in %s\n", name, filename);
+			continue;
+		}
+		if (value < params[i].min) value = params[i].min;
+		if (value > params[i].max) value = params[i].max;
+		*params[i].value = value;
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+int write_params(char *filename) {
+	int i;
+	FILE *fp = fopen(filename, "w");
+
+	if (fp == NULL) return FALSE;
+	fprintf(fp, "# name value\n");
+	for (i = 0; i < n_params; i++) {
+		fprintf(fp, "%s %d\n", params[i].name, *params[i].value);
+	}
+	fclose(fp);
+	return TRUE;
+}
+
+/**
+ *   Sets every parameter to theta + scale * step * delta, rounded and clamped
+ *   - delta may be NULL to set theta itself
+ */
+void set_params(double *theta, int *delta, double scale) {
+	int i, value;
+
+	for (i = 0; i < n_params; i++) {
+		value = (int) floor(theta[i] + (delta == NULL ? 0 : scale * params[i].step * delta[i]) + 0.5);
+		if (value < params[i].min) value = params[i].min;
+		if (value > params[i].max) value = params[i].max;
+		*params[i].value = value;
+	}
+	build_eval_table();
+}
+
+/**
+ *   Weights of eval_position for every number of disks on the board
+ *   ----------------------------------
+ *   - The opening weights blend into the midgame weights over TAPER_DISKS
+ *     disks centred on opening_disks, and those into parity alone over
+ *     TAPER_DISKS disks centred on 64 - late_empties
+ *   - Scores change smoothly from one move to the next, so positions a few
+ *     disks apart in the search compare fairly, and the evaluation picks
+ *     its weights by index instead of by phase
+ *   - Built again whenever the parameters change
+ */
+void build_eval_table() {
+	static const int late[5] = {1, 0, 0, 0, 0};
+	double opening, parity, w;
+	int n, i;
+
+	for (n = 0; n <= 64; n++) {
+		opening = (n - opening_disks + TAPER_DISKS / 2.0) / TAPER_DISKS;
+		parity = (n - 64 + late_empties + TAPER_DISKS / 2.0) / TAPER_DISKS;
+		opening = opening < 0 ? 0 : (opening > 1 ? 1 : opening);
+		parity = parity < 0 ? 0 : (parity > 1 ? 1 : parity);
+		for (i = 0; i < 5; i++) {
+			w = eval_weights[0][i] + opening * (eval_weights[1][i] - eval_weights[0][i]);
+			w += parity * (late[i] - w);
+			eval_table[n][i] = (int) floor(w + 0.5);
+		}
+	}
+}
+
+/**
+ *   All ranks execute this code
+ *   ----------------------------------
+ *   my_player tune <params file> <iterations> <game pairs> [seconds per move]
+ *   - SPSA: every iteration perturbs all tuned parameters at once by one
+ *     step up or down at random, and plays theta + c * delta against
+ *     theta - c * delta
+ *   - Game pairs share a random opening and swap colours, they are divided
+ *     between the ranks
+ *   - theta moves towards the side that won, by at most SPSA_RATE steps
+ *     per parameter at the first iteration, less later on
+ *   - Rank 0 rewrites the parameter file after every iteration, tuning
+ *     starts from it if it exists
+ */
+void run_tune(int argc, char *argv[]) {
+	double *theta = (double *) calloc(n_params, sizeof(double));
+	int *delta = (int *) calloc(n_params, sizeof(int));
+	int *start_board = (int *) calloc(BOARDSIZE, sizeof(int));
+	int rank, comm_sz, iterations, pairs, k, i, pair;
+	double move_time = TUNE_MOVE_TIME, points, total, result, c, gain, stability;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	if (argc < 5) {
+		if (rank == 0) fprintf(stderr, "Arguments: tune <params file> <iterations> <game pairs> [seconds per move]\n");
+		return;
+	}
+	iterations = atoi(argv[3]);
+	pairs = atoi(argv[4]);
+	if (argc >= 6) move_time = atof(argv[5]);
+	stability = iterations / 10.0;
+
+	load_params(argv[2]);
+	for (i = 0; i < n_params; i++) theta[i] = *params[i].value;
+	copy_board(board, start_board);
+	srand(time(NULL));
+	timeout = FALSE;
+
+	for (k = 1; k <= iterations && pairs > 0; k++) {
+		if (rank == 0) {
+			for (i = 0; i < n_params; i++) delta[i] = params[i].step == 0 ? 0 : (rand() % 2 ? 1 : -1);
+		}
+		MPI_Bcast(delta, n_params, MPI_INT, 0, MPI_COMM_WORLD);
+		c = 1.0 / pow(k, SPSA_GAMMA);
+
+		points = 0;
+		for (pair = rank; pair < pairs; pair += comm_sz) {
+			copy_board(start_board, board);
+			points += play_pair((unsigned long long) k * pairs + pair + 1, theta, delta, c, move_time);
+		}
+		MPI_Allreduce(&points, &total, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+
+		// Score of theta + c * delta, from -1 (lost every game) to 1
+		result = (total - pairs) / pairs;
+		gain = SPSA_RATE * pow(stability + 1, SPSA_ALPHA) / pow(stability + k, SPSA_ALPHA);
+		for (i = 0; i < n_params; i++) {
+			theta[i] += gain * params[i].step * result * delta[i] / c;
+			if (theta[i] < params[i].min) theta[i] = params[i].min;
+			if (theta[i] > params[i].max) theta[i] = params[i].max;
+		}
+
+		set_params(theta, NULL, 0);
+		if (rank == 0) {
+			write_params(argv[2]);
+			printf("Iteration %d: result %+.3f\n", k, result);
+			fflush(stdout);
+		}
+	}
+	free(theta);
+	free(delta);
+	free(start_board);
+}
+
+/**
+ *   Plays one random opening twice, theta + c * delta is black in the
+ *   first game and white in the second
+ *   - Once ENDGAME_EMPTIES squares are empty, the game is decided by a
+ *     win/loss/draw solve, the way the players would finish it
+ *   - Returns the points of theta + c * delta: 1 a win, 0.5 a draw
+ */
+double play_pair(unsigned long long seed, double *theta, int *delta, double c, double move_time) {
+	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	int *start_board = (int *) calloc(BOARDSIZE, sizeof(int));
+	int game, colour, plus, passes, plies, move, score;
+	unsigned long long state;
+	double points = 0;
+	uint64_t P, O;
+
+	copy_board(board, start_board);
+	for (game = 0; game < 2; game++) {
+		copy_board(start_board, board);
+		plus = game == 0 ? BLACK : WHITE;
+		colour = BLACK;
+		passes = 0;
+		plies = 0;
+		state = seed * 0x9E3779B97F4A7C15ULL;
+
+		while (passes < 2) {
+			legal_moves(colour, moves, NULL);
+			if (moves[0] == 0) {
+				passes++;
+				colour = opponent(colour, NULL);
+				continue;
+			}
+			passes = 0;
+			if (count_empties() <= ENDGAME_EMPTIES) break;
+
+			if (plies < TUNE_OPENING_PLIES) {
+				move = random_move(moves, &state);
+			} else {
+				set_params(theta, delta, colour == plus ? c : -c);
+				move = self_play_move(colour, move_time);
+			}
+			make_move(move, colour, NULL);
+			colour = opponent(colour, NULL);
+			plies++;
+		}
+
+		board_to_bitboards(colour, &P, &O);
+		score = passes == 2 ? final_score(P, O) : endgame_solve(P, O, -1, 1, NULL);
+		if (colour != plus) score = -score;
+		points += score > 0 ? 1 : (score == 0 ? 0.5 : 0);
+	}
+	set_params(theta, NULL, 0);
+	free(moves);
+	free(start_board);
+	return points;
+}
+
+/**
+ *   Best move for colour by iterative deepening on this rank alone
+ *   ---------------------------------------------------------------
+ *   - Same depths and stopping rule as strategy, with move_time instead of time_limit
+ *   - An interrupted depth only counts if no depth was completed
+ */
+int self_play_move(int colour, double move_time) {
+	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	int *scores = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	int *board_copy = (int *) calloc(BOARDSIZE, sizeof(int));
+	int i, depth, eval, alpha, best = -1, depth_best;
+	double move_start = MPI_Wtime(), depth_start;
+	double time_spent, time_spent_on_depth, last_depth_time = 0;
+
+	legal_moves(colour, moves, NULL);
+	max_colour = colour;
+	clear_tt();
+	copy_board(board, board_copy);
+	timeout = FALSE;
+	deadline = move_start + move_time - time_margin / 1000.0;
+
+	for (depth = starting_depth-1; moves[0] > 1; depth++) {
+		depth_start = MPI_Wtime();
+		alpha = -1000000;
+		depth_best = -1;
+		for (i = 1; i <= moves[0]; i++) {
+			make_move(moves[i], colour, NULL);
+			start_path();
+			eval = minimax(opponent(colour, NULL), depth, alpha, 1000000);
+			copy_board(board_copy, board);
+			if (timeout) break;
+			scores[i] = eval;
+			if (eval > alpha) {
+				alpha = eval;
+				depth_best = moves[i];
+			}
+		}
+		if (timeout) {
+			if (best == -1) best = depth_best;
+			break;
+		}
+		best = depth_best;
+		time_spent = MPI_Wtime() - move_start;
+		time_spent_on_depth = MPI_Wtime() - depth_start;
+		// moves[1] is still the best move of the depth before
+		if (depth + 1 >= depth_limit ||
+			!next_depth_fits(time_spent, time_spent_on_depth, last_depth_time, move_budget(move_time, best != moves[1]))) break;
+		last_depth_time = time_spent_on_depth;
+		order_root_moves(moves, scores, best);
+	}
+	if (best == -1) best = moves[1];
+	deadline = 0;
+	timeout = FALSE;
+	free(moves);
+	free(scores);
+	free(board_copy);
+	return best;
+}
+
+/**
+ *   All ranks execute this code
+ *   ----------------------------------
+ *   my_player selfplay <games> <outfile> [seconds per move]
+ *   - Writes training positions for the evaluation (layout in sample.h)
+ *   - Games start with TUNE_OPENING_PLIES random moves, then both sides play
+ *     self_play_move with the current parameters and evaluation
+ *   - With ENDGAME_EMPTIES empty squares the exact score is solved, every
+ *     position of the game gets it from the point of view of its side to move
+ *   - Games are divided between the ranks, each appends whole games to the file
+ */
+void run_selfplay(int argc, char *argv[]) {
+	unsigned char *buffer = (unsigned char *) malloc(64 * SAMPLE_SIZE);
+	int *moves = (int *) calloc(LEGALMOVSBUFSIZE, sizeof(int));
+	int *start_board = (int *) calloc(BOARDSIZE, sizeof(int));
+	uint64_t P[64], O[64];
+	int colours[64];
+	int rank, comm_sz, games, game, n, i, colour, passes, plies, move, score, written = 0, total;
+	double move_time = TUNE_MOVE_TIME;
+	unsigned long long state;
+	FILE *fp;
+	int fd;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &comm_sz);
+
+	if (argc < 4) {
+		if (rank == 0) fprintf(stderr, "Arguments: selfplay <games> <outfile> [seconds per move]\n");
+		return;
+	}
+	games = atoi(argv[2]);
+	if (argc >= 5) move_time = atof(argv[4]);
+
+	// Rank 0 empties the file before anyone appends
+	if (rank == 0) {
+		fp = fopen(argv[3], "wb");
+		if (fp != NULL) fclose(fp);
+	}
+	MPI_Barrier(MPI_COMM_WORLD);
+	fd = open(argv[3], O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		if (rank == 0) fprintf(stderr, "File %s could not be opened\n", argv[3]);
+		return;
+	}
+
+	copy_board(board, start_board);
+	for (game = rank; game < games; game += comm_sz) {
+		copy_board(start_board, board);
+		colour = BLACK;
+		passes = 0;
+		plies = 0;
+		n = 0;
+		state = (game + 1) * 0x9E3779B97F4A7C15ULL;
+
+		while (passes < 2) {
+			legal_moves(colour, moves, NULL);
+			if (moves[0] == 0) {
+				passes++;
+				colour = opponent(colour, NULL);
+				continue;
+			}
+			passes = 0;
+			board_to_bitboards(colour, &P[n], &O[n]);
+			colours[n++] = colour;
+			if (count_empties() <= ENDGAME_EMPTIES) break;
+
+			move = plies < TUNE_OPENING_PLIES ? random_move(moves, &state) : self_play_move(colour, move_time);
+			make_move(move, colour, NULL);
+			colour = opponent(colour, NULL);
+			plies++;
+		}
+
+		// Final score for black
+		board_to_bitboards(colour, &P[n], &O[n]);
+		score = passes == 2 ? final_score(P[n], O[n]) : endgame_solve(P[n], O[n], -64, 64, NULL);
+		if (colour != BLACK) score = -score;
+		for (i = 0; i < n; i++) {
+			pack_sample(buffer + i * SAMPLE_SIZE, P[i], O[i], colours[i] == BLACK ? score : -score);
+		}
+		if (write(fd, buffer, n * SAMPLE_SIZE) != n * SAMPLE_SIZE) {
+			fprintf(stderr, "Writing %s failed\n", argv[3]);
+			break;
+		}
+		written += n;
+	}
+	close(fd);
+
+	MPI_Reduce(&written, &total, 1, MPI_INT, MPI_SUM, 0, MPI_COMM_WORLD);
+	if (rank == 0) printf("Wrote %d positions from %d games\n", total, games);
+	free(buffer);
+	free(moves);
+	free(start_board);
+}
+
+/**
+ *   A random move of the list, for openings
+ */
+int random_move(int *moves, unsigned long long *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return moves[1 + *state % moves[0]];
+}
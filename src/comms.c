@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <poll.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include "comms.h" 
@@ -106,6 +107,18 @@ int comms_get_cmd(char cmd[], char move[]) {
 	return result;
 }
 
+/**
+ * Returns 1 if a message from the server is waiting, 0 if not, without blocking
+ */
+int comms_poll() {
+	struct pollfd fd;
+
+	fd.fd = socket_desc;
+	fd.events = POLLIN;
+	fd.revents = 0;
+	return poll(&fd, 1, 0) > 0;
+}
+
 /**
  * Sends a message to the server, which includes my_move 
  * and, if cmd == play_move, also the opponent's move 
@@ -10,6 +10,7 @@
 int comms_init(int* my_colour);
 int comms_init_network(int* my_colour, unsigned long ip, int port);
 int comms_get_cmd(char cmd[], char move[]);
+int comms_poll();
 int comms_send_move(char move[]);
 
 #endif
@@ -0,0 +1,387 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Exact endgame solver
+ *
+ *    Negamax alpha beta on bitboards, scores are the final disk difference
+ *    for the side to move. 
+ *    - Empty squares are kept in a linked list, ordered by square quality
+ *    - Far from the end, moves are sorted fastest-first (least opponent mobility)
+ *    - Close to the end, moves in regions with an odd number of empties go first
+ *    - Positions with enough empties are kept in a small hash table,
+ *      the bounds stay true so it is never cleared
+ *    - Stable disks bound the score, nodes are cut when the bound is outside the window
+ *    - The last 4 empties have their own solvers that do not use the list
+ *
+ *H***********************************************************************/
+
+#include <stdlib.h>
+#include "bitboard.h"
+#include "endgame.h"
+
+#define HASH_BITS 18
+#define HASH_MIN_EMPTIES 8		// positions closer to the end are not stored
+#define FASTEST_FIRST_EMPTIES 7	// sort by opponent mobility above this
+#define STABILITY_MIN_EMPTIES 7	// stability cutoffs only this far from the end
+#define POLL_NODES 4096			// nodes between calls to the poll function
+#define HEAD 64					// head of the empties list
+
+typedef struct {
+	uint64_t P;
+	uint64_t O;
+	signed char lower;
+	signed char upper;
+	unsigned char move;
+} endgame_entry_t;
+
+// Order in which empties are tried: corners first, X squares last
+static const int square_order[64] = {
+	 0,  7, 56, 63,
+	 2,  5, 16, 23, 40, 47, 58, 61,
+	 3,  4, 24, 31, 32, 39, 59, 60,
+	18, 21, 42, 45,
+	19, 20, 26, 29, 34, 37, 43, 44,
+	27, 28, 35, 36,
+	11, 12, 25, 30, 33, 38, 51, 52,
+	10, 13, 17, 22, 41, 46, 50, 53,
+	 1,  6,  8, 15, 48, 55, 57, 62,
+	 9, 14, 49, 54
+};
+
+static int next[HEAD+1];
+static int prev[HEAD+1];
+static int quadrant[64];
+static uint64_t neighbours[64];	// squares around each square
+static unsigned int parity;		// bit q is set when quadrant q has an odd number of empties
+static endgame_entry_t *hash_table = NULL;
+static unsigned long long nodes;
+static int stopped;
+static int (*poll_stop)();
+
+static int search(uint64_t P, uint64_t O, int alpha, int beta, int empties, int passed);
+static int solve_4(uint64_t P, uint64_t O, int alpha, int beta, int x1, int x2, int x3, int x4, int passed);
+
+void endgame_init() {
+	int sq, r, c;
+
+	for (sq = 0; sq < 64; sq++) {
+		quadrant[sq] = (sq / 32) * 2 + (sq % 8) / 4;
+		neighbours[sq] = 0;
+		for (r = sq / 8 - 1; r <= sq / 8 + 1; r++) {
+			for (c = sq % 8 - 1; c <= sq % 8 + 1; c++) {
+				if (r >= 0 && r < 8 && c >= 0 && c < 8 && r * 8 + c != sq) neighbours[sq] |= BIT(r * 8 + c);
+			}
+		}
+	}
+	hash_table = (endgame_entry_t *) calloc(1 << HASH_BITS, sizeof(endgame_entry_t));
+}
+
+void endgame_free() {
+	free(hash_table);
+}
+
+static void remove_empty(int sq) {
+	next[prev[sq]] = next[sq];
+	prev[next[sq]] = prev[sq];
+	parity ^= 1 << quadrant[sq];
+}
+
+static void restore_empty(int sq) {
+	next[prev[sq]] = sq;
+	prev[next[sq]] = sq;
+	parity ^= 1 << quadrant[sq];
+}
+
+static endgame_entry_t *hash_slot(uint64_t P, uint64_t O) {
+	uint64_t key = (P * 0x9E3779B97F4A7C15ULL) ^ (O * 0xC2B2AE3D27D4EB4FULL);
+	return &hash_table[(key >> 32) & ((1 << HASH_BITS) - 1)];
+}
+
+/**
+ *   Exact score of a position
+ *   --------------------------
+ *   - A win/loss/draw null window search goes first, then the exact search
+ *     only looks at scores on the winning (or losing) side of 0
+ *   - Fail soft: the result is a bound if it is outside (alpha, beta)
+ *   - Returns ENDGAME_STOPPED if poll returned true during the search
+ */
+int endgame_solve(uint64_t P, uint64_t O, int alpha, int beta, int (*poll)()) {
+	uint64_t empty = ~(P | O);
+	int i, sq, last = HEAD, empties = 0, wld, score;
+
+	// Build the empties list in square order
+	parity = 0;
+	for (i = 0; i < 64; i++) {
+		sq = square_order[i];
+		if (empty & BIT(sq)) {
+			next[last] = sq;
+			prev[sq] = last;
+			last = sq;
+			parity ^= 1 << quadrant[sq];
+			empties++;
+		}
+	}
+	next[last] = HEAD;
+	prev[HEAD] = last;
+
+	nodes = 0;
+	stopped = 0;
+	poll_stop = poll;
+
+	if (alpha < -64) alpha = -65;
+	if (beta > 64) beta = 65;
+
+	wld = search(P, O, -1, 1, empties, 0);
+	if (stopped) return ENDGAME_STOPPED;
+
+	if (wld == 0) {
+		score = 0;
+	} else if (wld > 0) {
+		if (beta <= 1) return wld;
+		score = search(P, O, alpha > 0 ? alpha : 0, beta, empties, 0);
+	} else {
+		if (alpha >= -1) return wld;
+		score = search(P, O, alpha, beta < 0 ? beta : 0, empties, 0);
+	}
+	if (stopped) return ENDGAME_STOPPED;
+	return score;
+}
+
+static int search(uint64_t P, uint64_t O, int alpha, int beta, int empties, int passed) {
+	uint64_t moves, flips, stable;
+	uint64_t child_flips[32];
+	int child_sq[32], child_key[32];
+	int n = 0, i, j, sq, score, best = -65, best_move = HEAD, q, round;
+	int alpha_start;
+	endgame_entry_t *entry = NULL;
+
+	if (stopped) return 0;
+	if (++nodes % POLL_NODES == 0 && poll_stop != NULL && poll_stop()) {
+		stopped = 1;
+		return 0;
+	}
+	if (empties == 0) return final_score(P, O);
+	if (empties == 4) {
+		i = next[HEAD];
+		j = next[i];
+		q = next[j];
+		sq = next[q];
+		return solve_4(P, O, alpha, beta, i, j, q, sq, passed);
+	}
+
+	// Stable disks of O can not be won back, and those of P can not be lost
+	if (empties >= STABILITY_MIN_EMPTIES) {
+		stable = get_stable(P, O);
+		score = 64 - 2 * bit_count(stable & O);
+		if (score <= alpha) return score;
+		score = 2 * bit_count(stable & P) - 64;
+		if (score >= beta) return score;
+	}
+
+	moves = get_moves(P, O);
+	if (moves == 0) {
+		if (passed) return final_score(P, O);
+		return -search(O, P, -beta, -alpha, empties, 1);
+	}
+
+	if (empties >= HASH_MIN_EMPTIES) {
+		entry = hash_slot(P, O);
+		if (entry->P == P && entry->O == O) {
+			if (entry->lower >= beta) return entry->lower;
+			if (entry->upper <= alpha) return entry->upper;
+			if (entry->lower > alpha) alpha = entry->lower;
+			if (entry->upper < beta) beta = entry->upper;
+			if (alpha >= beta) return alpha;
+			best_move = entry->move;
+		}
+	}
+	alpha_start = alpha;
+
+	if (empties > FASTEST_FIRST_EMPTIES) {
+		// Fastest first: fewest opponent moves after the move, hash move first
+		for (sq = next[HEAD]; sq != HEAD; sq = next[sq]) {
+			if (!(moves & BIT(sq))) continue;
+			flips = get_flips(sq, P, O);
+			score = (sq == best_move) ? -1 : bit_count(get_moves(O ^ flips, P ^ flips ^ BIT(sq)));
+			for (j = n; j > 0 && child_key[j-1] > score; j--) {
+				child_sq[j] = child_sq[j-1];
+				child_flips[j] = child_flips[j-1];
+				child_key[j] = child_key[j-1];
+			}
+			child_sq[j] = sq;
+			child_flips[j] = flips;
+			child_key[j] = score;
+			n++;
+		}
+	} else {
+		// Parity: squares in odd regions first, then even regions
+		for (round = 0; round < 2; round++) {
+			for (sq = next[HEAD]; sq != HEAD; sq = next[sq]) {
+				if (!(moves & BIT(sq))) continue;
+				q = (parity >> quadrant[sq]) & 1;
+				if (q != (round == 0)) continue;
+				child_sq[n] = sq;
+				child_flips[n] = get_flips(sq, P, O);
+				n++;
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		sq = child_sq[i];
+		flips = child_flips[i];
+		remove_empty(sq);
+		score = -search(O ^ flips, P ^ flips ^ BIT(sq), -beta, -alpha, empties - 1, 0);
+		restore_empty(sq);
+		if (stopped) return 0;
+
+		if (score > best) {
+			best = score;
+			best_move = sq;
+			if (score > alpha) {
+				alpha = score;
+				if (alpha >= beta) break;
+			}
+		}
+	}
+
+	if (entry != NULL) {
+		entry->P = P;
+		entry->O = O;
+		entry->lower = (best > alpha_start) ? best : -64;
+		entry->upper = (best < beta) ? best : 64;
+		entry->move = best_move;
+	}
+	return best;
+}
+
+/**
+ *   Solvers for the last empties
+ *   ----------------------------------
+ *   - No move generation: each empty is tried directly, a square with no
+ *     opponent neighbour cannot flip anything
+ *   - The last square only counts flips, the board is never changed
+ *   - With 3 and 4 empties, squares alone in their quadrant go first
+ */
+static int solve_1(uint64_t P, int x1) {
+	int p = bit_count(P), n;
+
+	nodes++;
+	n = count_last_flip(x1, P);
+	if (n) return 2 * (p + n) - 62;
+	// P passes, the other side plays the last square
+	n = count_last_flip(x1, ~P & ~BIT(x1));
+	if (n) return 2 * (p - n) - 64;
+	// nobody can play, the empty square goes to the winner
+	return (2 * p - 63 > 0) ? 2 * p - 62 : 2 * p - 64;
+}
+
+static int solve_2(uint64_t P, uint64_t O, int alpha, int beta, int x1, int x2, int passed) {
+	uint64_t flips;
+	int best = -65, score;
+
+	nodes++;
+	if ((O & neighbours[x1]) && (flips = get_flips(x1, P, O))) {
+		best = -solve_1(O ^ flips, x2);
+		if (best >= beta) return best;
+	}
+	if ((O & neighbours[x2]) && (flips = get_flips(x2, P, O))) {
+		score = -solve_1(O ^ flips, x1);
+		if (score > best) best = score;
+	}
+	if (best == -65) {
+		if (passed) return final_score(P, O);
+		return -solve_2(O, P, -beta, -alpha, x1, x2, 1);
+	}
+	return best;
+}
+
+static int solve_3(uint64_t P, uint64_t O, int alpha, int beta, int x1, int x2, int x3, int passed) {
+	uint64_t flips;
+	int best = -65, score, t;
+
+	nodes++;
+	// Parity: of three squares, one shares no quadrant or all three do
+	if (quadrant[x1] == quadrant[x2] && quadrant[x1] != quadrant[x3]) {
+		t = x1; x1 = x3; x3 = t;
+	} else if (quadrant[x1] == quadrant[x3] && quadrant[x1] != quadrant[x2]) {
+		t = x1; x1 = x2; x2 = t;
+	}
+
+	if ((O & neighbours[x1]) && (flips = get_flips(x1, P, O))) {
+		best = -solve_2(O ^ flips, P ^ flips ^ BIT(x1), -beta, -alpha, x2, x3, 0);
+		if (best >= beta) return best;
+		if (best > alpha) alpha = best;
+	}
+	if ((O & neighbours[x2]) && (flips = get_flips(x2, P, O))) {
+		score = -solve_2(O ^ flips, P ^ flips ^ BIT(x2), -beta, -alpha, x1, x3, 0);
+		if (score >= beta) return score;
+		if (score > best) {
+			best = score;
+			if (score > alpha) alpha = score;
+		}
+	}
+	if ((O & neighbours[x3]) && (flips = get_flips(x3, P, O))) {
+		score = -solve_2(O ^ flips, P ^ flips ^ BIT(x3), -beta, -alpha, x1, x2, 0);
+		if (score > best) best = score;
+	}
+	if (best == -65) {
+		if (passed) return final_score(P, O);
+		return -solve_3(O, P, -beta, -alpha, x1, x2, x3, 1);
+	}
+	return best;
+}
+
+static int solve_4(uint64_t P, uint64_t O, int alpha, int beta, int x1, int x2, int x3, int x4, int passed) {
+	uint64_t flips;
+	int best = -65, score, t;
+
+	nodes++;
+	// Parity: with a 2-1-1 split of quadrants, the two single squares go first
+	if (quadrant[x1] == quadrant[x2]) {
+		if (quadrant[x3] != quadrant[x4]) {
+			t = x1; x1 = x3; x3 = t;
+			t = x2; x2 = x4; x4 = t;
+		}
+	} else if (quadrant[x1] == quadrant[x3]) {
+		if (quadrant[x2] != quadrant[x4]) {
+			t = x1; x1 = x2; x2 = x4; x4 = x3; x3 = t;
+		}
+	} else if (quadrant[x1] == quadrant[x4]) {
+		if (quadrant[x2] != quadrant[x3]) {
+			t = x1; x1 = x2; x2 = x3; x3 = t;
+		}
+	}
+
+	if ((O & neighbours[x1]) && (flips = get_flips(x1, P, O))) {
+		best = -solve_3(O ^ flips, P ^ flips ^ BIT(x1), -beta, -alpha, x2, x3, x4, 0);
+		if (best >= beta) return best;
+		if (best > alpha) alpha = best;
+	}
+	if ((O & neighbours[x2]) && (flips = get_flips(x2, P, O))) {
+		score = -solve_3(O ^ flips, P ^ flips ^ BIT(x2), -beta, -alpha, x1, x3, x4, 0);
+		if (score >= beta) return score;
+		if (score > best) {
+			best = score;
+			if (score > alpha) alpha = score;
+		}
+	}
+	if ((O & neighbours[x3]) && (flips = get_flips(x3, P, O))) {
+		score = -solve_3(O ^ flips, P ^ flips ^ BIT(x3), -beta, -alpha, x1, x2, x4, 0);
+		if (score >= beta) return score;
+		if (score > best) {
+			best = score;
+			if (score > alpha) alpha = score;
+		}
+	}
+	if ((O & neighbours[x4]) && (flips = get_flips(x4, P, O))) {
+		score = -solve_3(O ^ flips, P ^ flips ^ BIT(x4), -beta, -alpha, x1, x2, x3, 0);
+		if (score > best) best = score;
+	}
+	if (best == -65) {
+		if (passed) return final_score(P, O);
+		return -solve_4(O, P, -beta, -alpha, x1, x2, x3, x4, 1);
+	}
+	return best;
+}
@@ -0,0 +1,12 @@
+#ifndef _ENDGAME_H
+#define _ENDGAME_H
+
+#include <stdint.h>
+
+#define ENDGAME_STOPPED -100 // returned when the poll function asked the solver to stop
+
+void endgame_init();
+void endgame_free();
+int endgame_solve(uint64_t P, uint64_t O, int alpha, int beta, int (*poll)());
+
+#endif
@@ -0,0 +1,250 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Neural network evaluation (NNUE)
+ *
+ *    A small network whose first layer only sees which disks are where.
+ *    - The first layer is sparse: its sum (the accumulator) is kept per
+ *      position along the search path and changed by a move only for the
+ *      placed disk and the flipped ones, never recomputed at the leaves
+ *    - Each side has its own accumulator so the side to move always sees
+ *      itself first
+ *    - The dense layers are int8 with AVX2 kernels, checked for at load
+ *      time, with plain C for other processors
+ *    - Weights come from a file (layout in nnue.h), trained outside the
+ *      player from the positions that my_player selfplay writes
+ *
+ *H***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+#include "bitboard.h"
+#include "nnue.h"
+
+#define NNUE_VERSION 1
+
+static int16_t b1[NNUE_HIDDEN] __attribute__((aligned(32)));
+static int16_t w1[NNUE_FEATURES][NNUE_HIDDEN] __attribute__((aligned(32)));
+static int16_t flip_row[64][NNUE_HIDDEN] __attribute__((aligned(32)));	// w1 of an own disk minus an other disk
+static int32_t b2[NNUE_DENSE];
+static int8_t w2[NNUE_DENSE][2 * NNUE_HIDDEN] __attribute__((aligned(32)));
+static int32_t b3;
+static int8_t w3[NNUE_DENSE] __attribute__((aligned(32)));
+
+static int loaded = 0;
+static int use_avx2 = 0;
+
+/**
+ * Reads the network file, returns 1 if it exists and fits this build
+ */
+int nnue_load(char *filename) {
+	nnue_header_t header;
+	int i, j, ok;
+	FILE *fp = fopen(filename, "rb");
+
+	loaded = 0;
+	if (fp == NULL) return 0;
+	ok = fread(&header, sizeof(header), 1, fp) == 1 && memcmp(header.magic, "OTHN", 4) == 0 &&
+		header.version == NNUE_VERSION && header.hidden == NNUE_HIDDEN && header.dense == NNUE_DENSE;
+	ok = ok && fread(b1, sizeof(b1), 1, fp) == 1 && fread(w1, sizeof(w1), 1, fp) == 1;
+	ok = ok && fread(b2, sizeof(b2), 1, fp) == 1 && fread(w2, sizeof(w2), 1, fp) == 1;
+	ok = ok && fread(&b3, sizeof(b3), 1, fp) == 1 && fread(w3, sizeof(w3), 1, fp) == 1;
+	fclose(fp);
+	if (!ok) {
+		fprintf(stderr, "%s does not match the network of this build\n", filename);
+		return 0;
+	}
+
+	for (i = 0; i < 64; i++) {
+		for (j = 0; j < NNUE_HIDDEN; j++) flip_row[i][j] = w1[i][j] - w1[64 + i][j];
+	}
+	__builtin_cpu_init();
+	use_avx2 = __builtin_cpu_supports("avx2");
+	loaded = 1;
+	return 1;
+}
+
+int nnue_loaded() {
+	return loaded;
+}
+
+/**
+ * Accumulators of a position from scratch, only at the root of a search
+ */
+void nnue_refresh(nnue_acc_t *acc, uint64_t P, uint64_t O) {
+	int i, sq;
+
+	for (i = 0; i < NNUE_HIDDEN; i++) acc->v[0][i] = acc->v[1][i] = b1[i];
+	while (P) {
+		sq = __builtin_ctzll(P);
+		P &= P - 1;
+		for (i = 0; i < NNUE_HIDDEN; i++) {
+			acc->v[0][i] += w1[sq][i];
+			acc->v[1][i] += w1[64 + sq][i];
+		}
+	}
+	while (O) {
+		sq = __builtin_ctzll(O);
+		O &= O - 1;
+		for (i = 0; i < NNUE_HIDDEN; i++) {
+			acc->v[0][i] += w1[64 + sq][i];
+			acc->v[1][i] += w1[sq][i];
+		}
+	}
+}
+
+/**
+ * Both accumulators stay in registers while the rows are added
+ */
+__attribute__((target("avx2")))
+static void move_avx2(const int16_t *from_mover, const int16_t *from_other, int16_t *mover, int16_t *other, int sq, uint64_t flips) {
+	__m256i m[4], o[4], row;
+	int i, f;
+
+	for (i = 0; i < 4; i++) {
+		m[i] = _mm256_add_epi16(_mm256_load_si256((const __m256i *) (from_mover + 16 * i)),
+			_mm256_load_si256((const __m256i *) (w1[sq] + 16 * i)));
+		o[i] = _mm256_add_epi16(_mm256_load_si256((const __m256i *) (from_other + 16 * i)),
+			_mm256_load_si256((const __m256i *) (w1[64 + sq] + 16 * i)));
+	}
+	while (flips) {
+		f = __builtin_ctzll(flips);
+		flips &= flips - 1;
+		for (i = 0; i < 4; i++) {
+			row = _mm256_load_si256((const __m256i *) (flip_row[f] + 16 * i));
+			m[i] = _mm256_add_epi16(m[i], row);
+			o[i] = _mm256_sub_epi16(o[i], row);
+		}
+	}
+	for (i = 0; i < 4; i++) {
+		_mm256_store_si256((__m256i *) (mover + 16 * i), m[i]);
+		_mm256_store_si256((__m256i *) (other + 16 * i), o[i]);
+	}
+}
+
+static void move_c(const int16_t *from_mover, const int16_t *from_other, int16_t *mover, int16_t *other, int sq, uint64_t flips) {
+	int i, f;
+
+	for (i = 0; i < NNUE_HIDDEN; i++) {
+		mover[i] = from_mover[i] + w1[sq][i];
+		other[i] = from_other[i] + w1[64 + sq][i];
+	}
+	while (flips) {
+		f = __builtin_ctzll(flips);
+		flips &= flips - 1;
+		for (i = 0; i < NNUE_HIDDEN; i++) {
+			mover[i] += flip_row[f][i];
+			other[i] -= flip_row[f][i];
+		}
+	}
+}
+
+/**
+ * Accumulators after side (0 for P, 1 for O) plays sq and flips flips
+ * - A flipped disk changes from an other disk to an own disk of the mover,
+ *   one row for each accumulator
+ */
+void nnue_move(const nnue_acc_t *from, nnue_acc_t *to, int sq, uint64_t flips, int side) {
+	if (use_avx2) move_avx2(from->v[side], from->v[1 - side], to->v[side], to->v[1 - side], sq, flips);
+	else move_c(from->v[side], from->v[1 - side], to->v[side], to->v[1 - side], sq, flips);
+}
+
+/**
+ * Sums of the 8 lanes of 4 rows
+ */
+__attribute__((target("avx2")))
+static __m128i sum_rows(__m256i s0, __m256i s1, __m256i s2, __m256i s3) {
+	s0 = _mm256_hadd_epi32(s0, s1);
+	s2 = _mm256_hadd_epi32(s2, s3);
+	s0 = _mm256_hadd_epi32(s0, s2);
+	return _mm_add_epi32(_mm256_castsi256_si128(s0), _mm256_extracti128_si256(s0, 1));
+}
+
+/**
+ * Dense layers with AVX2: inputs are clipped with saturating packs, and
+ * u8 x i8 products are summed in pairs then in fours
+ * - Negative sums clip to 0 either way, so a shift by 6 divides by NNUE_SCALE like C does
+ */
+__attribute__((target("avx2")))
+static int forward_avx2(const int16_t *first, const int16_t *second) {
+	__m256i input[4], sum[4], a, b, ones = _mm256_set1_epi16(1), max = _mm256_set1_epi8(127);
+	__m128i s, rows[NNUE_DENSE / 4];
+	uint8_t h[NNUE_DENSE] __attribute__((aligned(32)));
+	int i, j, k;
+
+	// 0..127, packus works on 128 bit lanes so the order is fixed by a permute
+	for (i = 0; i < 2; i++) {
+		a = _mm256_load_si256((const __m256i *) (first + 32 * i));
+		b = _mm256_load_si256((const __m256i *) (first + 32 * i + 16));
+		input[i] = _mm256_min_epu8(_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8), max);
+		a = _mm256_load_si256((const __m256i *) (second + 32 * i));
+		b = _mm256_load_si256((const __m256i *) (second + 32 * i + 16));
+		input[2 + i] = _mm256_min_epu8(_mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8), max);
+	}
+
+	for (j = 0; j < NNUE_DENSE; j += 4) {
+		for (k = 0; k < 4; k++) {
+			sum[k] = _mm256_setzero_si256();
+			for (i = 0; i < 4; i++) {
+				a = _mm256_maddubs_epi16(input[i], _mm256_load_si256((const __m256i *) (w2[j + k] + 32 * i)));
+				sum[k] = _mm256_add_epi32(sum[k], _mm256_madd_epi16(a, ones));
+			}
+		}
+		s = _mm_add_epi32(sum_rows(sum[0], sum[1], sum[2], sum[3]), _mm_loadu_si128((const __m128i *) (b2 + j)));
+		rows[j / 4] = _mm_srai_epi32(s, 6);
+	}
+	// 0..127 again, packs keep the order within 128 bits
+	for (j = 0; j < NNUE_DENSE / 4; j += 4) {
+		s = _mm_packus_epi16(_mm_packs_epi32(rows[j], rows[j + 1]), _mm_packs_epi32(rows[j + 2], rows[j + 3]));
+		_mm_store_si128((__m128i *) (h + 4 * j), _mm_min_epu8(s, _mm256_castsi256_si128(max)));
+	}
+
+	a = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i *) h), _mm256_load_si256((const __m256i *) w3));
+	b = _mm256_madd_epi16(a, ones);
+	s = _mm_add_epi32(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1));
+	s = _mm_hadd_epi32(s, s);
+	s = _mm_hadd_epi32(s, s);
+	return b3 + _mm_cvtsi128_si32(s);
+}
+
+static int forward_c(const int16_t *first, const int16_t *second) {
+	uint8_t input[2 * NNUE_HIDDEN], h[NNUE_DENSE];
+	int i, j, value, sum;
+
+	for (i = 0; i < NNUE_HIDDEN; i++) {
+		input[i] = first[i] < 0 ? 0 : (first[i] > 127 ? 127 : first[i]);
+		input[NNUE_HIDDEN + i] = second[i] < 0 ? 0 : (second[i] > 127 ? 127 : second[i]);
+	}
+	for (j = 0; j < NNUE_DENSE; j++) {
+		sum = b2[j];
+		for (i = 0; i < 2 * NNUE_HIDDEN; i++) sum += input[i] * w2[j][i];
+		value = sum / NNUE_SCALE;
+		h[j] = value < 0 ? 0 : (value > 127 ? 127 : value);
+	}
+	sum = b3;
+	for (j = 0; j < NNUE_DENSE; j++) sum += h[j] * w3[j];
+	return sum;
+}
+
+/**
+ * Score for P in 1/100 of a disk, side (0 for P, 1 for O) is to move
+ */
+int nnue_eval(const nnue_acc_t *acc, int side) {
+	int score;
+
+	if (use_avx2) score = forward_avx2(acc->v[side], acc->v[1 - side]);
+	else score = forward_c(acc->v[side], acc->v[1 - side]);
+	score /= NNUE_SCALE;
+	return side == 0 ? score : -score;
+}
+
+/**
+ * nnue_eval of each of n positions with the same side to move, the children of one node
+ */
+void nnue_eval_batch(const nnue_acc_t *acc, int n, int side, int *scores) {
+	int b;
+
+	for (b = 0; b < n; b++) scores[b] = nnue_eval(&acc[b], side);
+}
@@ -0,0 +1,42 @@
+#ifndef _NNUE_H
+#define _NNUE_H
+
+#include <stdint.h>
+
+#define NNUE_FEATURES 128			// own disk on a square (0-63), other disk (64-127)
+#define NNUE_HIDDEN 64				// accumulator width of one perspective
+#define NNUE_DENSE 32				// width of the dense layer
+#define NNUE_SCALE 64				// dense weights are in 1/NNUE_SCALE
+
+/*
+ * Layout of the network file, all numbers in host byte order, after the header:
+ * int16 b1[NNUE_HIDDEN], int16 w1[NNUE_FEATURES][NNUE_HIDDEN],
+ * int32 b2[NNUE_DENSE], int8 w2[NNUE_DENSE][2 * NNUE_HIDDEN],
+ * int32 b3, int8 w3[NNUE_DENSE].
+ *
+ * An accumulator is b1 plus the rows of w1 of the features of one side,
+ * clipped to 0..127 it gives the inputs of the dense layer, side to move
+ * first. The dense layer divides by NNUE_SCALE and clips to 0..127 again,
+ * the output divided by NNUE_SCALE is the score of the side to move in
+ * 1/100 of a disk.
+ */
+typedef struct {
+	char magic[4];		// "OTHN"
+	int version;
+	int hidden;
+	int dense;
+} nnue_header_t;
+
+// Accumulators of both sides of a position, v[0] for P and v[1] for O
+typedef struct {
+	int16_t v[2][NNUE_HIDDEN] __attribute__((aligned(32)));
+} nnue_acc_t;
+
+int nnue_load(char *filename);
+int nnue_loaded();
+void nnue_refresh(nnue_acc_t *acc, uint64_t P, uint64_t O);
+void nnue_move(const nnue_acc_t *from, nnue_acc_t *to, int sq, uint64_t flips, int side);
+int nnue_eval(const nnue_acc_t *acc, int side);
+void nnue_eval_batch(const nnue_acc_t *acc, int n, int side, int *scores);
+
+#endif
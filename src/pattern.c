@@ -0,0 +1,263 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Pattern evaluation
+ *
+ *    The score of a position is the sum of one weight for every pattern
+ *    on the board, looked up by the ternary code of the squares it covers
+ *    (empty 0, side to move 1, other side 2), plus a constant per phase.
+ *    - Pattern classes: edge with both X squares, 3x3 corner, 2x5 corner,
+ *      rows and columns 2 to 4, and the diagonals of length 4 to 8
+ *    - Symmetric copies of a class share its weights
+ *    - Weights come from a binary file (layout in pattern.h), mapped
+ *      read only so all ranks on a host share the same pages, and
+ *      trained offline by tools/train.c
+ *    - Sibling positions can be scored together, one per AVX2 lane,
+ *      checked for at load time, with plain C for other processors
+ *
+ *H***********************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <immintrin.h>
+#include "bitboard.h"
+#include "pattern.h"
+
+#define PATTERN_VERSION 1
+#define CLASSES 11
+#define MAX_SQUARES 10
+
+typedef struct {
+	int n_squares;
+	int squares[MAX_SQUARES];	// (row, column) as 8 * row + column, of the first copy
+	int n_copies;
+	int symmetries[8];			// symmetries that give the copies
+} pattern_class_t;
+
+static const pattern_class_t classes[CLASSES] = {
+	{10, {0, 1, 2, 3, 4, 5, 6, 7, 9, 14}, 4, {0, 2, 4, 5}},		// edge + 2X
+	{9, {0, 1, 2, 8, 9, 10, 16, 17, 18}, 4, {0, 1, 2, 3}},			// corner 3x3
+	{10, {0, 1, 2, 3, 4, 8, 9, 10, 11, 12}, 8, {0, 1, 2, 3, 4, 5, 6, 7}}, // corner 2x5
+	{8, {8, 9, 10, 11, 12, 13, 14, 15}, 4, {0, 2, 4, 5}},			// row 2
+	{8, {16, 17, 18, 19, 20, 21, 22, 23}, 4, {0, 2, 4, 5}},		// row 3
+	{8, {24, 25, 26, 27, 28, 29, 30, 31}, 4, {0, 2, 4, 5}},		// row 4
+	{8, {0, 9, 18, 27, 36, 45, 54, 63}, 2, {0, 1}},				// diagonal 8
+	{7, {1, 10, 19, 28, 37, 46, 55}, 4, {0, 1, 2, 3}},				// diagonal 7
+	{6, {2, 11, 20, 29, 38, 47}, 4, {0, 1, 2, 3}},					// diagonal 6
+	{5, {3, 12, 21, 30, 39}, 4, {0, 1, 2, 3}},						// diagonal 5
+	{4, {4, 13, 22, 31}, 4, {0, 1, 2, 3}}							// diagonal 4
+};
+
+// Every pattern copy a square is part of, and the power of 3 of the square in its code
+typedef struct {
+	int n;
+	unsigned char instance[16];
+	int power[16];
+} square_patterns_t;
+
+static int instance_offset[PATTERN_INSTANCES];	// first weight of the class of the copy
+static square_patterns_t square_patterns[64];
+static int n_weights = 0;
+static int power3[MAX_SQUARES + 1];
+
+static void *mapping = NULL;
+static size_t mapping_size;
+static const short *weights = NULL;
+static int use_avx2 = 0;
+
+/**
+ * Square sq under one of the 8 symmetries of the board
+ */
+static int symmetric(int sq, int symmetry) {
+	int r = sq / 8, c = sq % 8, t;
+
+	if (symmetry & 4) { t = r; r = c; c = t; }	// transpose
+	if (symmetry & 1) c = 7 - c;				// mirror left to right
+	if (symmetry & 2) r = 7 - r;				// mirror top to bottom
+	return 8 * r + c;
+}
+
+/**
+ * Builds the squares of every copy of every class, done once
+ */
+static void initialise_patterns() {
+	int i, j, k, sq, n = 0, offset = 0;
+	square_patterns_t *sp;
+
+	if (n_weights != 0) return;
+	power3[0] = 1;
+	for (i = 1; i <= MAX_SQUARES; i++) power3[i] = 3 * power3[i-1];
+
+	for (i = 0; i < CLASSES; i++) {
+		for (j = 0; j < classes[i].n_copies; j++) {
+			instance_offset[n] = offset;
+			for (k = 0; k < classes[i].n_squares; k++) {
+				sq = symmetric(classes[i].squares[k], classes[i].symmetries[j]);
+				sp = &square_patterns[sq];
+				sp->instance[sp->n] = n;
+				sp->power[sp->n] = power3[k];
+				sp->n++;
+			}
+			n++;
+		}
+		offset += power3[classes[i].n_squares];
+	}
+	n_weights = offset + 1; // the last weight is the constant
+}
+
+/**
+ * Number of weights in one phase
+ */
+int pattern_weights() {
+	initialise_patterns();
+	return n_weights;
+}
+
+int pattern_phase(uint64_t P, uint64_t O) {
+	return (bit_count(P | O) - 4) * PATTERN_PHASES / 61;
+}
+
+/**
+ * Index into the weights of one phase for every pattern copy, from the point of view of P
+ */
+void pattern_indices(uint64_t P, uint64_t O, int *indices) {
+	const square_patterns_t *sp;
+	int i, sq;
+
+	initialise_patterns();
+	memcpy(indices, instance_offset, sizeof(instance_offset));
+	// Only the occupied squares add to the codes
+	while (P) {
+		sq = __builtin_ctzll(P);
+		P &= P - 1;
+		sp = &square_patterns[sq];
+		for (i = 0; i < sp->n; i++) indices[sp->instance[i]] += sp->power[i];
+	}
+	while (O) {
+		sq = __builtin_ctzll(O);
+		O &= O - 1;
+		sp = &square_patterns[sq];
+		for (i = 0; i < sp->n; i++) indices[sp->instance[i]] += 2 * sp->power[i];
+	}
+}
+
+/**
+ * Maps the weights file, returns 1 if it exists and fits these patterns
+ */
+int pattern_load(char *filename) {
+	struct stat st;
+	const pattern_header_t *header;
+	int fd;
+
+	initialise_patterns();
+	pattern_free();
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return 0;
+	if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(pattern_header_t)) {
+		close(fd);
+		return 0;
+	}
+	mapping_size = st.st_size;
+	mapping = mmap(NULL, mapping_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		mapping = NULL;
+		return 0;
+	}
+
+	header = (const pattern_header_t *) mapping;
+	if (memcmp(header->magic, "OTHW", 4) != 0 || header->version != PATTERN_VERSION ||
+		header->phases != PATTERN_PHASES || header->weights != n_weights ||
+		mapping_size < sizeof(pattern_header_t) + (size_t) PATTERN_PHASES * n_weights * sizeof(short)) {
+		fprintf(stderr, "%s does not match the patterns of this build\n", filename);
+		pattern_free();
+		return 0;
+	}
+	weights = (const short *) ((const char *) mapping + sizeof(pattern_header_t));
+	__builtin_cpu_init();
+	use_avx2 = __builtin_cpu_supports("avx2");
+	return 1;
+}
+
+void pattern_free() {
+	if (mapping != NULL) munmap(mapping, mapping_size);
+	mapping = NULL;
+	weights = NULL;
+}
+
+int pattern_loaded() {
+	return weights != NULL;
+}
+
+/**
+ * Predicted final disk difference for P, in 1/PATTERN_SCALE of a disk
+ */
+int pattern_eval(uint64_t P, uint64_t O) {
+	int indices[PATTERN_INSTANCES];
+	const short *w = weights + (size_t) pattern_phase(P, O) * n_weights;
+	int i, score = w[n_weights - 1];
+
+	pattern_indices(P, O, indices);
+	for (i = 0; i < PATTERN_INSTANCES; i++) score += w[indices[i]];
+	return score;
+}
+
+/**
+ * Sums the weights of the instances of up to PATTERN_BATCH positions, one per lane
+ * - index[i] holds the weight of instance i of every lane, counted from the
+ *   first weight of all phases
+ * - Gathers read 32 bits ending at the weight, so the high half is the weight
+ *   and nothing past the end of the mapping is read
+ */
+__attribute__((target("avx2")))
+static void sum_batch_avx2(const int (*index)[PATTERN_BATCH], int n, int *scores) {
+	const int *base = (const int *) (weights - 1);
+	int sums[PATTERN_BATCH] __attribute__((aligned(32)));
+	__m256i sum = _mm256_setzero_si256(), w;
+	int i;
+
+	for (i = 0; i <= PATTERN_INSTANCES; i++) {
+		w = _mm256_i32gather_epi32(base, _mm256_load_si256((const __m256i *) index[i]), 2);
+		sum = _mm256_add_epi32(sum, _mm256_srai_epi32(w, 16));
+	}
+	_mm256_store_si256((__m256i *) sums, sum);
+	memcpy(scores, sums, n * sizeof(int));
+}
+
+static void sum_batch_c(const int (*index)[PATTERN_BATCH], int n, int *scores) {
+	int i, b;
+
+	for (b = 0; b < n; b++) {
+		scores[b] = 0;
+		for (i = 0; i <= PATTERN_INSTANCES; i++) scores[b] += weights[index[i][b]];
+	}
+}
+
+/**
+ * pattern_eval of n positions, at most PATTERN_BATCH, the children of one node
+ * - The codes are found one position at a time, the weights are then added
+ *   for all positions at once
+ */
+void pattern_eval_batch(const uint64_t *P, const uint64_t *O, int n, int *scores) {
+	int index[PATTERN_INSTANCES + 1][PATTERN_BATCH] __attribute__((aligned(32)));
+	int indices[PATTERN_INSTANCES];
+	int i, b, offset;
+
+	for (b = 0; b < PATTERN_BATCH; b++) {
+		if (b >= n) {
+			for (i = 0; i <= PATTERN_INSTANCES; i++) index[i][b] = 0;
+			continue;
+		}
+		offset = pattern_phase(P[b], O[b]) * n_weights;
+		pattern_indices(P[b], O[b], indices);
+		for (i = 0; i < PATTERN_INSTANCES; i++) index[i][b] = offset + indices[i];
+		index[PATTERN_INSTANCES][b] = offset + n_weights - 1;	// the constant
+	}
+	if (use_avx2) sum_batch_avx2((const int (*)[PATTERN_BATCH]) index, n, scores);
+	else sum_batch_c((const int (*)[PATTERN_BATCH]) index, n, scores);
+}
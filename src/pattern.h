@@ -0,0 +1,31 @@
+#ifndef _PATTERN_H
+#define _PATTERN_H
+
+#include <stdint.h>
+
+#define PATTERN_PHASES 12			// weight sets, by number of disks on the board
+#define PATTERN_INSTANCES 46		// patterns on the board, including symmetric copies
+#define PATTERN_SCALE 100			// weights are in 1/PATTERN_SCALE of a disk
+#define PATTERN_BATCH 8				// positions pattern_eval_batch scores at once, one per AVX2 lane
+
+/*
+ * Layout of the weights file, all numbers in host byte order:
+ * the header, then PATTERN_PHASES sets of pattern_weights() shorts.
+ */
+typedef struct {
+	char magic[4];		// "OTHW"
+	int version;
+	int phases;
+	int weights;		// weights in one phase
+} pattern_header_t;
+
+int pattern_load(char *filename);
+void pattern_free();
+int pattern_loaded();
+int pattern_weights();
+int pattern_phase(uint64_t P, uint64_t O);
+void pattern_indices(uint64_t P, uint64_t O, int *indices);
+int pattern_eval(uint64_t P, uint64_t O);
+void pattern_eval_batch(const uint64_t *P, const uint64_t *O, int n, int *scores);
+
+#endif
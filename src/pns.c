@@ -0,0 +1,207 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Depth-first proof-number search (df-pn)
+ *
+ *    Proves or disproves that the side to move wins, without a heuristic
+ *    evaluation.
+ *    - Every node tries to prove "score >= target" for its side to move,
+ *      the target of a child is 1 - target (a win needs a child scoring <= -1)
+ *    - Proof and disproof numbers live in a fixed size table, so memory is
+ *      bounded; entries that took little work are replaced first
+ *    - Children close to the end are settled by the endgame solver with a
+ *      null window instead of being expanded
+ *    - Results stay true between calls, so a stopped search resumes
+ *      where it left off and the table is never cleared
+ *
+ *H***********************************************************************/
+
+#include <stdlib.h>
+#include "bitboard.h"
+#include "endgame.h"
+#include "pns.h"
+
+#define PNS_BITS 19				// 2^PNS_BITS entries, in buckets of 2
+#define PNS_INF 100000000		// proof or disproof number of a settled node
+#define LEAF_EMPTIES 14			// children with this many empties are solved
+#define POLL_NODES 16			// expanded nodes and solved leaves between calls to the poll function
+#define PASS 64					// move of a node whose only child is a pass
+
+typedef struct {
+	uint64_t P;
+	uint64_t O;
+	unsigned int pn;
+	unsigned int dn;
+	unsigned int work;			// nodes expanded below this node
+	signed char target;
+	unsigned char move;			// child that proves the node
+} pns_entry_t;
+
+static pns_entry_t *table = NULL;
+static unsigned int nodes;
+static int stopped;
+static int (*poll_stop)();
+
+static void mid(uint64_t P, uint64_t O, int target, unsigned int th_pn, unsigned int th_dn);
+
+void pns_free() {
+	free(table);
+	table = NULL;
+}
+
+static pns_entry_t *lookup(uint64_t P, uint64_t O, int target) {
+	uint64_t key = (P * 0x9E3779B97F4A7C15ULL) ^ (O * 0xC2B2AE3D27D4EB4FULL) ^ target;
+	pns_entry_t *bucket = &table[(key >> 32) & ((1 << PNS_BITS) - 2)];
+
+	if (bucket[0].P == P && bucket[0].O == O && bucket[0].target == target) return &bucket[0];
+	if (bucket[1].P == P && bucket[1].O == O && bucket[1].target == target) return &bucket[1];
+	return NULL;
+}
+
+static void store(uint64_t P, uint64_t O, int target, unsigned int pn, unsigned int dn, unsigned int work, int move) {
+	uint64_t key = (P * 0x9E3779B97F4A7C15ULL) ^ (O * 0xC2B2AE3D27D4EB4FULL) ^ target;
+	pns_entry_t *entry = lookup(P, O, target);
+
+	if (entry == NULL) {
+		entry = &table[(key >> 32) & ((1 << PNS_BITS) - 2)];
+		if (entry[1].work < entry[0].work) entry++;
+	}
+	entry->P = P;
+	entry->O = O;
+	entry->target = target;
+	entry->pn = pn;
+	entry->dn = dn;
+	entry->work = work;
+	entry->move = move;
+}
+
+static int poll_now() {
+	if (++nodes % POLL_NODES == 0 && poll_stop != NULL && poll_stop()) stopped = 1;
+	return stopped;
+}
+
+/**
+ *   Proof and disproof number of a child that may not have been expanded yet
+ *   - Finished games and positions close to the end are settled right away
+ */
+static void get_numbers(uint64_t P, uint64_t O, int target, unsigned int *pn, unsigned int *dn) {
+	pns_entry_t *entry = lookup(P, O, target);
+	int score;
+
+	if (entry != NULL) {
+		*pn = entry->pn;
+		*dn = entry->dn;
+		return;
+	}
+	*pn = 1;
+	*dn = bit_count(get_moves(P, O)) + 1;
+	if (bit_count(~(P | O)) <= LEAF_EMPTIES) {
+		if (poll_now()) return;
+		score = endgame_solve(P, O, target - 1, target, poll_stop);
+		if (score == ENDGAME_STOPPED) {
+			stopped = 1;
+			return;
+		}
+	} else if (*dn == 1 && get_moves(O, P) == 0) {
+		score = final_score(P, O);
+	} else {
+		return;
+	}
+	*pn = score >= target ? 0 : PNS_INF;
+	*dn = score >= target ? PNS_INF : 0;
+	store(P, O, target, *pn, *dn, 0, PASS);
+}
+
+/**
+ *   Expands the node until its proof number reaches th_pn or its
+ *   disproof number reaches th_dn, then stores both in the table
+ */
+static void mid(uint64_t P, uint64_t O, int target, unsigned int th_pn, unsigned int th_dn) {
+	uint64_t moves, flips;
+	uint64_t child_P[32], child_O[32];
+	int child_sq[32];
+	unsigned int pn, dn, child_pn, child_dn, best_pn = 0, second_dn;
+	unsigned int work_start = nodes;
+	int n = 0, i, sq, best = 0;
+
+	if (poll_now()) return;
+
+	moves = get_moves(P, O);
+	if (moves == 0) {
+		if (get_moves(O, P) == 0) { // only possible at the root
+			pn = final_score(P, O) >= target ? 0 : PNS_INF;
+			store(P, O, target, pn, PNS_INF - pn, 0, PASS);
+			return;
+		}
+		child_P[0] = O;
+		child_O[0] = P;
+		child_sq[0] = PASS;
+		n = 1;
+	}
+	while (moves) {
+		sq = __builtin_ctzll(moves);
+		moves &= moves - 1;
+		flips = get_flips(sq, P, O);
+		child_P[n] = O & ~flips;
+		child_O[n] = P | flips | BIT(sq);
+		child_sq[n] = sq;
+		n++;
+	}
+
+	while (1) {
+		// The node is proven by any child that is disproven, disproven by all children being proven
+		pn = PNS_INF;
+		dn = 0;
+		second_dn = PNS_INF;
+		for (i = 0; i < n; i++) {
+			get_numbers(child_P[i], child_O[i], 1 - target, &child_pn, &child_dn);
+			if (child_dn < pn) {
+				second_dn = pn;
+				pn = child_dn;
+				best_pn = child_pn;
+				best = i;
+			} else if (child_dn < second_dn) {
+				second_dn = child_dn;
+			}
+			dn += child_pn;
+			if (dn > PNS_INF) dn = PNS_INF;
+		}
+		if (stopped || pn >= th_pn || dn >= th_dn) break;
+
+		// Search the most proving child until it is no longer the best one
+		mid(child_P[best], child_O[best], 1 - target,
+			th_dn - dn + best_pn, th_pn < second_dn + 1 ? th_pn : second_dn + 1);
+	}
+	if (stopped) return;
+	store(P, O, target, pn, dn, nodes - work_start, child_sq[best]);
+}
+
+/**
+ *   Tries to prove that the side to move wins
+ *   -----------------------------------------
+ *   - Returns PNS_WIN and sets move (bit index, 64 for a pass) to a
+ *     winning move, PNS_NO_WIN if there is none
+ *   - Returns PNS_UNKNOWN if poll returned true first, calling again
+ *     continues the same proof
+ */
+int pns_prove(uint64_t P, uint64_t O, int *move, int (*poll)()) {
+	pns_entry_t *root;
+
+	if (table == NULL) table = (pns_entry_t *) calloc(1 << PNS_BITS, sizeof(pns_entry_t));
+
+	nodes = 0;
+	stopped = 0;
+	poll_stop = poll;
+
+	mid(P, O, 1, PNS_INF, PNS_INF);
+	if (stopped) return PNS_UNKNOWN;
+
+	root = lookup(P, O, 1);
+	if (root == NULL) return PNS_UNKNOWN;
+	if (root->pn == 0) {
+		*move = root->move;
+		return PNS_WIN;
+	}
+	return root->dn == 0 ? PNS_NO_WIN : PNS_UNKNOWN;
+}
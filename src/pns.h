@@ -0,0 +1,13 @@
+#ifndef _PNS_H
+#define _PNS_H
+
+#include <stdint.h>
+
+#define PNS_UNKNOWN 0	// stopped before the root was proven or disproven
+#define PNS_WIN 1		// the side to move wins, move is set to a winning move
+#define PNS_NO_WIN 2	// the side to move draws or loses
+
+void pns_free();
+int pns_prove(uint64_t P, uint64_t O, int *move, int (*poll)());
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _SAMPLE_H
+#define _SAMPLE_H
+
+#include <stdint.h>
+
+/*
+ * One training position on disk, 17 bytes:
+ * P and O as little endian 64 bit numbers (P is to move),
+ * then the final disk difference for P as a signed byte.
+ */
+#define SAMPLE_SIZE 17
+
+static inline void pack_sample(unsigned char *buffer, uint64_t P, uint64_t O, int score) {
+	int i;
+
+	for (i = 0; i < 8; i++) {
+		buffer[i] = (P >> (8 * i)) & 0xFF;
+		buffer[8 + i] = (O >> (8 * i)) & 0xFF;
+	}
+	buffer[16] = (unsigned char) (signed char) score;
+}
+
+static inline void unpack_sample(const unsigned char *buffer, uint64_t *P, uint64_t *O, int *score) {
+	int i;
+
+	*P = 0;
+	*O = 0;
+	for (i = 7; i >= 0; i--) {
+		*P = (*P << 8) | buffer[i];
+		*O = (*O << 8) | buffer[8 + i];
+	}
+	*score = (signed char) buffer[16];
+}
+
+#endif
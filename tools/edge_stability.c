@@ -0,0 +1,94 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Edge stability table generator, run by make
+ *
+ *    Writes a C header with the stable disks of every one of the 3^8
+ *    configurations of an edge. Disks on an edge can only be flipped
+ *    along the edge, so a disk is stable if no sequence of disks placed
+ *    on the empty squares of the edge (by either side, in any order)
+ *    ever flips it.
+ *
+ *    Usage: edge_stability > edge_stability.h
+ *
+ *H***********************************************************************/
+
+#include <stdio.h>
+
+#define CONFIGS 6561	// 3^8
+#define UNKNOWN 256
+
+static int memo[CONFIGS];
+static int power[9];
+
+static int cell(int config, int i) {
+	return config / power[i] % 3;
+}
+
+/**
+ *   Places a disk of colour at empty square i and flips along the edge
+ */
+static int place(int config, int i, int colour) {
+	int other = 3 - colour, dir, j, k;
+
+	config += colour * power[i];
+	for (dir = -1; dir <= 1; dir += 2) {
+		for (j = i + dir; j >= 0 && j < 8 && cell(config, j) == other; j += dir);
+		if (j < 0 || j >= 8 || j == i + dir || cell(config, j) != colour) continue;
+		for (k = i + dir; k != j; k += dir) config += (colour - other) * power[k];
+	}
+	return config;
+}
+
+/**
+ *   Bit i is set if the disk on square i can never be flipped
+ */
+static int stable(int config) {
+	int i, colour, child, changed, j, result = 0;
+
+	if (memo[config] != UNKNOWN) return memo[config];
+	for (i = 0; i < 8; i++) {
+		if (cell(config, i) != 0) result |= 1 << i;
+	}
+	for (i = 0; i < 8; i++) {
+		if (cell(config, i) != 0) continue;
+		for (colour = 1; colour <= 2; colour++) {
+			child = place(config, i, colour);
+			changed = 0;
+			for (j = 0; j < 8; j++) {
+				if (j != i && cell(child, j) != cell(config, j)) changed |= 1 << j;
+			}
+			result &= ~changed & stable(child);
+		}
+	}
+	memo[config] = result;
+	return result;
+}
+
+int main() {
+	int i, b, t;
+
+	power[0] = 1;
+	for (i = 1; i <= 8; i++) power[i] = power[i-1] * 3;
+	for (i = 0; i < CONFIGS; i++) memo[i] = UNKNOWN;
+
+	printf("/* Generated by tools/edge_stability.c, do not edit */\n\n");
+	printf("// Ternary index of the 8 bits of an edge, disks of the side to move count 1, others 2\n");
+	printf("static const unsigned short edge_ternary[256] = {");
+	for (b = 0; b < 256; b++) {
+		t = 0;
+		for (i = 0; i < 8; i++) {
+			if (b & (1 << i)) t += power[i];
+		}
+		printf("%s%d,", b % 16 == 0 ? "\n\t" : " ", t);
+	}
+	printf("\n};\n\n");
+	printf("// Stable disks of every edge configuration, indexed by edge_ternary[P] + 2 * edge_ternary[O]\n");
+	printf("static const unsigned char edge_stable[%d] = {", CONFIGS);
+	for (i = 0; i < CONFIGS; i++) {
+		printf("%s%d,", i % 16 == 0 ? "\n\t" : " ", stable(i));
+	}
+	printf("\n};\n");
+	return 0;
+}
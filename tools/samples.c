@@ -0,0 +1,120 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Training sample generator
+ *
+ *    Plays random games until SOLVE_EMPTIES squares are empty, then plays
+ *    the rest perfectly with the endgame solver. Every position of the
+ *    game is written with the exact final score of that line, from the
+ *    point of view of the side to move (layout in sample.h).
+ *
+ *    Usage: samples <games> <seed> <samples.bin>
+ *
+ *H***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bitboard.h"
+#include "endgame.h"
+#include "sample.h"
+
+#define SOLVE_EMPTIES 14	// perfect play from here on
+#define MAX_PLIES 128		// moves and passes in one game
+
+typedef struct {
+	uint64_t P;
+	uint64_t O;
+} position_t;
+
+static unsigned long long state;
+
+static unsigned long long next_random() {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ *   A random move, or the move with the best exact score once few squares are empty
+ */
+static int choose_move(uint64_t P, uint64_t O, uint64_t moves) {
+	uint64_t flips;
+	int sq, n, best = -1, score, best_score = -65;
+
+	if (bit_count(~(P | O)) > SOLVE_EMPTIES) {
+		n = next_random() % bit_count(moves);
+		while (n-- > 0) moves &= moves - 1;
+		return __builtin_ctzll(moves);
+	}
+	while (moves) {
+		sq = __builtin_ctzll(moves);
+		moves &= moves - 1;
+		flips = get_flips(sq, P, O);
+		score = -endgame_solve(O & ~flips, P | flips | BIT(sq), -64, 64, NULL);
+		if (score > best_score) {
+			best_score = score;
+			best = sq;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	position_t game[MAX_PLIES];
+	unsigned char buffer[SAMPLE_SIZE];
+	uint64_t P, O, moves, flips, t;
+	int games, g, i, n, sq, passes, score;
+	long written = 0;
+	FILE *out;
+
+	if (argc != 4) {
+		fprintf(stderr, "Usage: samples <games> <seed> <samples.bin>\n");
+		return 1;
+	}
+	games = atoi(argv[1]);
+	state = strtoull(argv[2], NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+	out = fopen(argv[3], "wb");
+	if (out == NULL) {
+		fprintf(stderr, "File %s could not be opened\n", argv[3]);
+		return 1;
+	}
+	endgame_init();
+
+	for (g = 0; g < games; g++) {
+		P = BIT(28) | BIT(35); // black to move
+		O = BIT(27) | BIT(36);
+		n = 0;
+		passes = 0;
+		while (passes < 2 && n < MAX_PLIES) {
+			game[n].P = P;
+			game[n].O = O;
+			n++;
+			moves = get_moves(P, O);
+			if (moves == 0) {
+				passes++;
+			} else {
+				passes = 0;
+				sq = choose_move(P, O, moves);
+				flips = get_flips(sq, P, O);
+				P |= flips | BIT(sq);
+				O &= ~flips;
+			}
+			t = P; P = O; O = t;
+		}
+		// P is to move in the final position, positions before alternate sides
+		score = final_score(P, O);
+		for (i = n - 1; i >= 0; i--) {
+			score = -score;
+			if (get_moves(game[i].P, game[i].O) == 0) continue; // passes add nothing
+			pack_sample(buffer, game[i].P, game[i].O, score);
+			fwrite(buffer, SAMPLE_SIZE, 1, out);
+			written++;
+		}
+	}
+	fclose(out);
+	endgame_free();
+	printf("Wrote %ld samples from %d games\n", written, games);
+	return 0;
+}
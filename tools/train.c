@@ -0,0 +1,162 @@
+/* vim: :se ai :se sw=4 :se ts=4 :se sts :se et */
+
+/*H**********************************************************************
+ *
+ *    Pattern weight trainer
+ *
+ *    Least squares fit of the pattern weights of src/pattern.c to the
+ *    scores of a sample file (layout in sample.h), written as the weights
+ *    file the player maps at startup.
+ *    - The samples are streamed from disk in chunks, never held in memory
+ *    - Every sample touches one weight per pattern copy plus the constant
+ *      of its phase, so each step is a sparse gradient step
+ *    - Threads split every chunk and update the shared weights without
+ *      locks; their rare collisions only add a little noise
+ *    - Weights that no sample touched stay 0
+ *
+ *    Usage: train <samples.bin> <weights.bin> [epochs] [threads] [rate]
+ *
+ *H***********************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "bitboard.h"
+#include "pattern.h"
+#include "sample.h"
+
+#define CHUNK 65536		// samples read at a time
+#define MAX_THREADS 64
+
+typedef struct {
+	const unsigned char *samples;
+	int n;
+	double rate;
+	double squared_error;	// sum over the samples of this thread, before their step
+} job_t;
+
+static float *weights;		// PATTERN_PHASES sets of pattern_weights(), in disks
+static int n_weights;
+
+/**
+ *   One gradient step per sample in the slice of the chunk given to the thread
+ */
+static void *train_slice(void *arg) {
+	job_t *job = (job_t *) arg;
+	int indices[PATTERN_INSTANCES];
+	uint64_t P, O;
+	int i, j, score;
+	float *w, error, step;
+
+	job->squared_error = 0;
+	for (i = 0; i < job->n; i++) {
+		unpack_sample(job->samples + (size_t) i * SAMPLE_SIZE, &P, &O, &score);
+		w = weights + (size_t) pattern_phase(P, O) * n_weights;
+		pattern_indices(P, O, indices);
+
+		error = w[n_weights - 1] - score;
+		for (j = 0; j < PATTERN_INSTANCES; j++) error += w[indices[j]];
+		job->squared_error += error * error;
+
+		step = job->rate * error;
+		w[n_weights - 1] -= step;
+		for (j = 0; j < PATTERN_INSTANCES; j++) w[indices[j]] -= step;
+	}
+	return NULL;
+}
+
+/**
+ *   Writes the weights file, rounded to 1/PATTERN_SCALE of a disk
+ */
+static int export_weights(char *filename) {
+	pattern_header_t header;
+	FILE *fp = fopen(filename, "wb");
+	long i, n = (long) PATTERN_PHASES * n_weights;
+	double value;
+	short w;
+
+	if (fp == NULL) return 0;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "OTHW", 4);
+	header.version = 1;
+	header.phases = PATTERN_PHASES;
+	header.weights = n_weights;
+	fwrite(&header, sizeof(header), 1, fp);
+	for (i = 0; i < n; i++) {
+		value = floor(weights[i] * PATTERN_SCALE + 0.5);
+		if (value > 32767) value = 32767;
+		if (value < -32767) value = -32767;
+		w = (short) value;
+		fwrite(&w, sizeof(w), 1, fp);
+	}
+	fclose(fp);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	unsigned char *chunk;
+	pthread_t threads[MAX_THREADS];
+	job_t jobs[MAX_THREADS];
+	int epochs = 10, n_threads = 4, epoch, t, n, per_thread;
+	double rate = 0.002, squared_error;
+	long total;
+	FILE *fp;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: train <samples.bin> <weights.bin> [epochs] [threads] [rate]\n");
+		return 1;
+	}
+	if (argc > 3) epochs = atoi(argv[3]);
+	if (argc > 4) n_threads = atoi(argv[4]);
+	if (argc > 5) rate = atof(argv[5]);
+	if (n_threads < 1) n_threads = 1;
+	if (n_threads > MAX_THREADS) n_threads = MAX_THREADS;
+
+	n_weights = pattern_weights();
+	weights = (float *) calloc((size_t) PATTERN_PHASES * n_weights, sizeof(float));
+	chunk = (unsigned char *) malloc((size_t) CHUNK * SAMPLE_SIZE);
+
+	for (epoch = 1; epoch <= epochs; epoch++) {
+		fp = fopen(argv[1], "rb");
+		if (fp == NULL) {
+			fprintf(stderr, "File %s could not be opened\n", argv[1]);
+			return 1;
+		}
+		total = 0;
+		squared_error = 0;
+		while ((n = fread(chunk, SAMPLE_SIZE, CHUNK, fp)) > 0) {
+			per_thread = (n + n_threads - 1) / n_threads;
+			for (t = 0; t < n_threads; t++) {
+				jobs[t].samples = chunk + (size_t) t * per_thread * SAMPLE_SIZE;
+				jobs[t].n = n - t * per_thread;
+				if (jobs[t].n > per_thread) jobs[t].n = per_thread;
+				if (jobs[t].n < 0) jobs[t].n = 0;
+				jobs[t].rate = rate;
+				pthread_create(&threads[t], NULL, train_slice, &jobs[t]);
+			}
+			for (t = 0; t < n_threads; t++) {
+				pthread_join(threads[t], NULL);
+				squared_error += jobs[t].squared_error;
+			}
+			total += n;
+		}
+		fclose(fp);
+		if (total == 0) {
+			fprintf(stderr, "No samples in %s\n", argv[1]);
+			return 1;
+		}
+		printf("epoch %d: %ld samples, mean error %.2f disks\n", epoch, total, sqrt(squared_error / total));
+		fflush(stdout);
+	}
+
+	if (!export_weights(argv[2])) {
+		fprintf(stderr, "File %s could not be written\n", argv[2]);
+		return 1;
+	}
+	printf("Wrote %s\n", argv[2]);
+	free(weights);
+	free(chunk);
+	return 0;
+}